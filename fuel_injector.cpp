@@ -29,7 +29,7 @@ enum {
     kParamClockSource,
     kParamClockInput,
     kParamResetInput,
-    kNumSharedParams = 14
+    kNumSharedParams
 };
 
 // Per-channel parameter offsets
@@ -40,9 +40,53 @@ enum {
     kParamsPerChannel = 3
 };
 
+// Parameters added since the first release follow the channel blocks, so presets saved
+// before them keep every parameter index: first these shared ones, then one Group
+// parameter per channel.
+enum {
+    kAddedParamReroll,
+    kAddedParamClockMult,
+    kAddedParamTolerance,
+    kAddedParamAutoGrid,
+    kNumAddedSharedParams
+};
+
+static inline int addedParamIndex(int numChannels, int param) {
+    return kNumSharedParams + numChannels * kParamsPerChannel + param;
+}
+
+static inline int groupParamIndex(int numChannels, int c) {
+    return addedParamIndex(numChannels, kNumAddedSharedParams) + c;
+}
+
+static inline int numParameters(int numChannels) {
+    return groupParamIndex(numChannels, numChannels);
+}
+
+static inline int addedParam(const _FuelInjectorAlgorithm* self, int param) {
+    return self->v[addedParamIndex(self->numChannels, param)];
+}
+
+// Control page: the shared parameters before the routing ones, then the added shared ones.
+static const int kNumControlParams = kParamClockSource + kNumAddedSharedParams;
+
+// Routing page: clock and reset, then each channel's parameters and its Group.
+static const int kRoutingParamsPerChannel = kParamsPerChannel + 1;
+
+// Bytes reserved per channel for its parameter names (one 16-byte slot per parameter).
+static const int kChannelNameBytes = kRoutingParamsPerChannel * 16;
+
 static const char* clockSourceStrings[] = { "CV", "MIDI", NULL };
+static const char* offOnStrings[] = { "Off", "On", NULL };
+static const char* groupStrings[] = { "Own", "A", "B", "C", "D", NULL };
 static const char* ppqnStrings[] = { "1", "2", "4", "8", "16", "24", "48", NULL };
 static const int ppqnValues[] = { 1, 2, 4, 8, 16, 24, 48 };
+static const char* clockMultStrings[] = { "x1", "x2", "x3", "x4", "x6", "x8", "x12", "x24", "x48", NULL };
+static const int clockMultValues[] = { 1, 2, 3, 4, 6, 8, 12, 24, 48 };
+
+static const float TRIGGER_THRESHOLD = 1.0f;
+static const float TRIGGER_HIGH = 5.0f;
+static const float SIMILARITY_THRESHOLD = 90.0f;
 
 static inline uint8_t scaledPercent(uint8_t probability, uint8_t fuel) {
     return (uint8_t)(((uint16_t)probability * (uint16_t)fuel) / 100);
@@ -84,6 +128,17 @@ static const _NT_parameter channelParamTemplate[] = {
     NT_PARAMETER_CV_OUTPUT_WITH_MODE("Trig Out", 0, 15)
 };
 
+// Shared parameters added after the channel blocks (see kNumAddedSharedParams)
+static const _NT_parameter addedSharedParameters[] = {
+    { .name = "Re-roll", .min = 0, .max = 1, .def = 1, .unit = kNT_unitEnum, .scaling = 0, .enumStrings = offOnStrings },
+    { .name = "Clock Mult", .min = 0, .max = 8, .def = 0, .unit = kNT_unitEnum, .scaling = 0, .enumStrings = clockMultStrings },
+    { .name = "Tolerance", .min = 0, .max = MAX_TOLERANCE_TICKS, .def = 0, .unit = kNT_unitNone, .scaling = 0, .enumStrings = NULL },
+    { .name = "Auto Grid", .min = 0, .max = 1, .def = 0, .unit = kNT_unitEnum, .scaling = 0, .enumStrings = offOnStrings },
+};
+
+static const _NT_parameter groupParamTemplate =
+    { .name = "Group", .min = 0, .max = 4, .def = 0, .unit = kNT_unitEnum, .scaling = 0, .enumStrings = groupStrings };
+
 // Static requirements (shared memory)
 static void fuel_injector_calculate_static_requirements(_NT_staticRequirements& req) {
     req.dram = 0;
@@ -104,19 +159,21 @@ static void fuel_injector_calculate_requirements(_NT_algorithmRequirements& req,
     if (numChannels > MAX_CHANNELS) numChannels = MAX_CHANNELS;
     
     // Compute dynamic parameter count
-    const int kNumSharedParams = 14;  // Fuel through Reset Input
-    const int kParamsPerChannel = 3;  // Trig In, Trig Out, Trig Out Mode
-    int numParams = kNumSharedParams + numChannels * kParamsPerChannel;
+    int numParams = numParameters(numChannels);
     
     req.numParameters = numParams;
     req.sram = sizeof(_FuelInjectorAlgorithm)
                 + numParams * sizeof(_NT_parameter)
                 + 2 * sizeof(_NT_parameterPage)
-                + 11 * sizeof(uint8_t)  // control page indices
-                + (3 + numChannels * 3) * sizeof(uint8_t)  // routing page indices
-                + numChannels * 48;  // parameter name strings ("Trig N In", "Trig N Out", "Trig N Out mode")
+                + kNumControlParams * sizeof(uint8_t)  // control page indices
+                + (3 + numChannels * kRoutingParamsPerChannel) * sizeof(uint8_t)  // routing page indices
+                + numChannels * kChannelNameBytes;  // parameter name strings ("Trig N In", ..., "Trig N Group")
     req.dram = numChannels * sizeof(ChannelPattern)
-                + numChannels * MAX_TICKS_PER_BAR * sizeof(bool);
+                + numChannels * sizeof(HitHistogram)
+                + numChannels * sizeof(GrooveCache)
+                + numChannels * (sizeof(BarHistory) + sizeof(LearnedPhrase))
+                + numChannels * sizeof(HitIndex)
+                + numChannels * VARIATION_BANK_SIZE * sizeof(EventList);  // variation banks
     req.dtc = sizeof(_FuelInjector_DTC);
     req.itc = 0;
 }
@@ -128,9 +185,7 @@ static _NT_algorithm* fuel_injector_construct(const _NT_algorithmMemoryPtrs& ptr
     if (numChannels < 1) numChannels = 1;
     if (numChannels > MAX_CHANNELS) numChannels = MAX_CHANNELS;
     
-    const int kNumSharedParams = 14;
-    const int kParamsPerChannel = 3;
-    int numParams = kNumSharedParams + numChannels * kParamsPerChannel;
+    int numParams = numParameters(numChannels);
     
     // Use placement new to construct algorithm in provided SRAM
     _FuelInjectorAlgorithm* alg = new (ptrs.sram) _FuelInjectorAlgorithm();
@@ -147,13 +202,13 @@ static _NT_algorithm* fuel_injector_construct(const _NT_algorithmMemoryPtrs& ptr
     alg->numPages = 2;
     
     alg->controlPageParams = mem;
-    mem += 11 * sizeof(uint8_t);
+    mem += kNumControlParams * sizeof(uint8_t);
     
     alg->routingPageParams = mem;
-    mem += (3 + numChannels * 3) * sizeof(uint8_t);
+    mem += (3 + numChannels * kRoutingParamsPerChannel) * sizeof(uint8_t);
     
     char* paramNames = (char*)mem;
-    mem += numChannels * 48;
+    mem += numChannels * kChannelNameBytes;
     
     alg->numChannels = numChannels;
 
@@ -161,21 +216,38 @@ static _NT_algorithm* fuel_injector_construct(const _NT_algorithmMemoryPtrs& ptr
         uint8_t* dram = (uint8_t*)ptrs.dram;
         alg->learned_patterns = (ChannelPattern*)dram;
         dram += numChannels * sizeof(ChannelPattern);
-        alg->output_patterns = (bool (*)[MAX_TICKS_PER_BAR])dram;
+        alg->histograms = (HitHistogram*)dram;
+        dram += numChannels * sizeof(HitHistogram);
+        alg->groove_caches = (GrooveCache*)dram;
+        dram += numChannels * sizeof(GrooveCache);
+        alg->bar_histories = (BarHistory*)dram;
+        dram += numChannels * sizeof(BarHistory);
+        alg->phrases = (LearnedPhrase*)dram;
+        dram += numChannels * sizeof(LearnedPhrase);
+        alg->hit_indices = (HitIndex*)dram;
+        dram += numChannels * sizeof(HitIndex);
+        alg->output_events = (EventList*)dram;
 
         memset(alg->learned_patterns, 0, numChannels * sizeof(ChannelPattern));
-        memset(alg->output_patterns, 0, numChannels * MAX_TICKS_PER_BAR * sizeof(bool));
+        memset(alg->histograms, 0, numChannels * sizeof(HitHistogram));
+        memset(alg->groove_caches, 0, numChannels * sizeof(GrooveCache));
+        memset(alg->bar_histories, 0, numChannels * sizeof(BarHistory));
+        memset(alg->phrases, 0, numChannels * sizeof(LearnedPhrase));
+        memset(alg->hit_indices, 0, numChannels * sizeof(HitIndex));
+        memset(alg->output_events, 0, numChannels * VARIATION_BANK_SIZE * sizeof(EventList));
     }
     
     memcpy(alg->params, sharedParameters, sizeof(sharedParameters));
+    memcpy(&alg->params[addedParamIndex(numChannels, 0)], addedSharedParameters, sizeof(addedSharedParameters));
     
     for (int c = 0; c < numChannels; ++c) {
         int base = kNumSharedParams + c * kParamsPerChannel;
         memcpy(&alg->params[base], channelParamTemplate, sizeof(channelParamTemplate));
         
-        char* inName = paramNames + c * 48;
-        char* outName = paramNames + c * 48 + 12;
-        char* modeName = paramNames + c * 48 + 24;
+        char* inName = paramNames + c * kChannelNameBytes;
+        char* outName = paramNames + c * kChannelNameBytes + 16;
+        char* modeName = paramNames + c * kChannelNameBytes + 32;
+        char* groupName = paramNames + c * kChannelNameBytes + 48;
         
         int len = 0;
         inName[len++] = 'T'; inName[len++] = 'r'; inName[len++] = 'i'; inName[len++] = 'g'; inName[len++] = ' ';
@@ -194,36 +266,48 @@ static _NT_algorithm* fuel_injector_construct(const _NT_algorithmMemoryPtrs& ptr
         modeName[len++] = ' '; modeName[len++] = 'm'; modeName[len++] = 'o'; modeName[len++] = 'd'; modeName[len++] = 'e';
         modeName[len] = '\0';
         
+        len = 0;
+        groupName[len++] = 'T'; groupName[len++] = 'r'; groupName[len++] = 'i'; groupName[len++] = 'g'; groupName[len++] = ' ';
+        groupName[len++] = '1' + c;
+        groupName[len++] = ' '; groupName[len++] = 'G'; groupName[len++] = 'r'; groupName[len++] = 'o'; groupName[len++] = 'u';
+        groupName[len++] = 'p'; groupName[len] = '\0';
+        
         alg->params[base + 0].name = inName;
         alg->params[base + 1].name = outName;
         alg->params[base + 2].name = modeName;
+        alg->params[groupParamIndex(numChannels, c)] = groupParamTemplate;
+        alg->params[groupParamIndex(numChannels, c)].name = groupName;
         alg->params[base + 0].def = 3 + c;
         alg->params[base + 1].def = 15 + c;
     }
     
     // Build Control page indices
-    for (int i = 0; i < 11; ++i) {
+    for (int i = 0; i < kParamClockSource; ++i) {
         alg->controlPageParams[i] = i;
     }
+    for (int i = 0; i < kNumAddedSharedParams; ++i) {
+        alg->controlPageParams[kParamClockSource + i] = addedParamIndex(numChannels, i);
+    }
     
     // Build Routing page indices
-    alg->routingPageParams[0] = 11;  // Clock Source
-    alg->routingPageParams[1] = 12;  // Clock Input
-    alg->routingPageParams[2] = 13;  // Reset Input
+    alg->routingPageParams[0] = kParamClockSource;
+    alg->routingPageParams[1] = kParamClockInput;
+    alg->routingPageParams[2] = kParamResetInput;
     for (int c = 0; c < numChannels; ++c) {
         int base = kNumSharedParams + c * kParamsPerChannel;
-        alg->routingPageParams[3 + c * 3 + 0] = base + 0;  // Trig In
-        alg->routingPageParams[3 + c * 3 + 1] = base + 1;  // Trig Out
-        alg->routingPageParams[3 + c * 3 + 2] = base + 2;  // Trig Out Mode
+        alg->routingPageParams[3 + c * kRoutingParamsPerChannel + 0] = base + 0;  // Trig In
+        alg->routingPageParams[3 + c * kRoutingParamsPerChannel + 1] = base + 1;  // Trig Out
+        alg->routingPageParams[3 + c * kRoutingParamsPerChannel + 2] = base + 2;  // Trig Out Mode
+        alg->routingPageParams[3 + c * kRoutingParamsPerChannel + 3] = groupParamIndex(numChannels, c);  // Group
     }
     
     // Set up pages
     alg->pages[0].name = "Control";
-    alg->pages[0].numParams = 11;
+    alg->pages[0].numParams = kNumControlParams;
     alg->pages[0].params = alg->controlPageParams;
     
     alg->pages[1].name = "Routing";
-    alg->pages[1].numParams = 3 + numChannels * 3;
+    alg->pages[1].numParams = 3 + numChannels * kRoutingParamsPerChannel;
     alg->pages[1].params = alg->routingPageParams;
     
     // Set up parameter pages wrapper
@@ -239,9 +323,10 @@ static _NT_algorithm* fuel_injector_construct(const _NT_algorithmMemoryPtrs& ptr
         alg->dtc = (_FuelInjector_DTC*)ptrs.dtc;
         alg->dtc->state = LEARNING;
         alg->dtc->bar_counter = 0;
-        alg->dtc->bars_since_lock = 0;
         alg->dtc->samples_since_clock = 0;
+        alg->dtc->samples_since_tick = 0;
         alg->dtc->last_clock_period_samples = 0;
+        resetClockTracker(alg->dtc->clock, 1);
         alg->dtc->current_bar_position = 0;
         alg->dtc->clock_tick_counter = 0;
         alg->dtc->prev_clock_value = 0.0f;
@@ -249,9 +334,36 @@ static _NT_algorithm* fuel_injector_construct(const _NT_algorithmMemoryPtrs& ptr
         alg->dtc->current_bar_index = 0;
         alg->dtc->is_injection_bar = false;
         alg->dtc->prng.state = 12345;
-        alg->dtc->stable_bars_count = 0;
         alg->dtc->required_stable_bars = 2;
+        alg->dtc->gen_channel = 0;
+        alg->dtc->pattern_epoch = 0;
+        alg->dtc->fast_lock_blocked = 0;
+        alg->dtc->coarse_locked = 0;
+        alg->dtc->carried_hits = 0;
+        alg->dtc->unlocked_this_bar = 0;
+        alg->dtc->unlocked_last_bar = 0;
+        alg->dtc->grid_ppqn = 0;
+        alg->dtc->grid_ticks_per_bar = 0;
+        alg->dtc->inferred_ppqn_index = 0;
+        alg->dtc->inferred_bar_length = 0;
+        alg->dtc->grid_from_reset = false;
+        alg->dtc->grid_check_due = false;
+        alg->dtc->pulses_since_reset = 0;
+        alg->dtc->reset_span = 0;
         for (int c = 0; c < MAX_CHANNELS; ++c) {
+            alg->dtc->channel_state[c] = LEARNING;
+            alg->dtc->stable_bars_count[c] = 0;
+            alg->dtc->group_leader[c] = (uint8_t)c;
+            alg->dtc->bars_since_lock[c] = 0;
+            alg->dtc->phrase_length[c] = 1;
+            memset(alg->dtc->phrase_matches[c], 0, sizeof(alg->dtc->phrase_matches[c]));
+            alg->dtc->variation_ready[c] = 0;
+            alg->dtc->active_variation[c] = -1;
+            alg->dtc->bank_phrase_bar[c] = -1;
+            alg->dtc->play_cursor[c] = 0;
+            alg->dtc->trigger_level[c] = TRIGGER_HIGH;
+            alg->dtc->pending_count[c] = 0;
+            alg->dtc->missed_hits[c] = 0;
             alg->dtc->prev_trigger_value[c] = 0.0f;
             alg->dtc->trigger_active_steps_remaining[c] = 0;
         }
@@ -259,560 +371,1738 @@ static _NT_algorithm* fuel_injector_construct(const _NT_algorithmMemoryPtrs& ptr
     
     for (int c = 0; c < MAX_CHANNELS; ++c) {
         memset(&alg->patterns[c], 0, sizeof(ChannelPattern));
+        memset(&alg->refinement[c], 0, sizeof(LearnRefinement));
+        memset(&alg->learned_window[c], 0, sizeof(PatternBits));
     }
+    memset(&alg->onsets, 0, sizeof(OnsetHistory));
     
     return reinterpret_cast<_NT_algorithm*>(alg);
 }
 
-static void fuel_injector_parameter_changed(_NT_algorithm* self_base, int p_idx) {
-    _FuelInjectorAlgorithm* self = static_cast<_FuelInjectorAlgorithm*>(self_base);
-    
-    if (p_idx == kParamPPQN || p_idx == kParamBarLength) {
-        self->dtc->state = LEARNING;
-        self->dtc->bar_counter = 0;
-        self->dtc->bars_since_lock = 0;
-        self->dtc->samples_since_clock = 0;
-        self->dtc->last_clock_period_samples = 0;
-        self->dtc->current_bar_position = 0;
-        self->dtc->clock_tick_counter = 0;
-        self->dtc->current_bar_index = 0;
-        self->dtc->stable_bars_count = 0;
-        self->dtc->is_injection_bar = false;
-        
-        for (int c = 0; c < self->numChannels; ++c) {
-            memset(&self->patterns[c], 0, sizeof(ChannelPattern));
-            memset(&self->learned_patterns[c], 0, sizeof(ChannelPattern));
-            self->dtc->trigger_active_steps_remaining[c] = 0;
-        }
+static inline EventList& variationEvents(_FuelInjectorAlgorithm* self, int c, int slot) {
+    return self->output_events[c * VARIATION_BANK_SIZE + slot];
+}
+
+// Channel patterns are only reached through these so that a bumped pattern epoch empties
+// them on first use.
+static inline ChannelPattern& channelPattern(_FuelInjectorAlgorithm* self, int c) {
+    return syncPattern(self->patterns[c], self->dtc->pattern_epoch);
+}
+
+static inline ChannelPattern& learnedPattern(_FuelInjectorAlgorithm* self, int c) {
+    return syncPattern(self->learned_patterns[c], self->dtc->pattern_epoch);
+}
+
+static inline BarHistory& barHistory(_FuelInjectorAlgorithm* self, int c) {
+    return syncHistory(self->bar_histories[c], self->dtc->pattern_epoch);
+}
+
+// Bar of channel c's locked phrase that bar number `bar` plays, or -1 when c is not locked
+// to a phrase.
+static inline int phraseBarIndex(const _FuelInjectorAlgorithm* self, int c, uint32_t bar) {
+    const int length = self->dtc->phrase_length[self->dtc->group_leader[c]];
+    return (length > 1) ? (int)(bar % (uint32_t)length) : -1;
+}
+
+// The learned bar variations of channel c are rendered from: bar `phraseBar` of its phrase,
+// or its learned bar when that is -1.
+static const PatternBits& variationSource(_FuelInjectorAlgorithm* self, int c, int phraseBar) {
+    return (phraseBar >= 0) ? self->phrases[c].bars[phraseBar] : recordedBar(learnedPattern(self, c), 0);
+}
+
+// Hit index of `bar`, one of channel c's learned bars. It is rebuilt here, on the first
+// injection after the bar or the grid changed, so locks, refinement and phrase bars need not
+// maintain it.
+static const HitIndex& learnedHitIndex(_FuelInjectorAlgorithm* self, int c, const PatternBits& bar, int ppqn,
+                                       int ticksPerBar) {
+    HitIndex& index = self->hit_indices[c];
+    if (!hitIndexCurrent(index, bar, ticksPerBar, ppqn)) {
+        buildHitIndex(index, bar, ticksPerBar, ppqn);
     }
+    return index;
 }
 
-// Main audio processing callback
-static void fuel_injector_step(_NT_algorithm* self_base, float* busFrames, int numFramesBy4) {
-    _FuelInjectorAlgorithm* self = static_cast<_FuelInjectorAlgorithm*>(self_base);
-    
-    int numFrames = numFramesBy4 * 4;
-    int clockBus = self->v[kParamClockInput] - 1;
-    int resetBus = self->v[kParamResetInput] - 1;
-    int ppqn = ppqnValues[self->v[kParamPPQN]];
+// Widen each learned bar by the Tolerance setting. Incoming hits are matched against these
+// windows as they arrive, so they must follow every change of a learned bar, the grid or
+// the tolerance.
+static void refreshLearnedWindows(_FuelInjectorAlgorithm* self, int ticksPerBar) {
+    for (int c = 0; c < self->numChannels; ++c) {
+        dilateBits(recordedBar(learnedPattern(self, c), 0), addedParam(self, kAddedParamTolerance), ticksPerBar,
+                   self->learned_window[c]);
+    }
+}
+
+// Mark every pre-rendered variation stale; the background fill rebuilds them.
+static void invalidateVariations(_FuelInjectorAlgorithm* self) {
+    for (int c = 0; c < self->numChannels; ++c) {
+        self->dtc->variation_ready[c] = 0;
+    }
+}
+
+// The internal tick grid selected by the PPQN, Bar Length and Clock Mult parameters.
+struct TickGrid {
+    int clockPpqn;      // incoming clock resolution
+    int multiplier;     // internal ticks per incoming pulse
+    int ppqn;           // internal ticks per quarter note
+    int ticksPerBar;
+};
+
+static TickGrid resolveTickGrid(const _FuelInjectorAlgorithm* self) {
+    TickGrid grid;
+    int ppqnIndex = self->v[kParamPPQN];
     int barLength = self->v[kParamBarLength];
-    int maxBarLength = MAX_TICKS_PER_BAR / ppqn;
+    if (addedParam(self, kAddedParamAutoGrid) && self->dtc->inferred_bar_length > 0) {
+        // Auto Grid: the bar inferred from the input replaces PPQN and Bar Length.
+        ppqnIndex = self->dtc->inferred_ppqn_index;
+        barLength = self->dtc->inferred_bar_length;
+    }
+    grid.clockPpqn = ppqnValues[ppqnIndex];
+    int maxBarLength = MAX_TICKS_PER_BAR / grid.clockPpqn;
     if (barLength > maxBarLength) {
         barLength = maxBarLength;
     }
     if (barLength < 1) {
         barLength = 1;
     }
-    int ticksPerBar = ppqn * barLength;
-    int fuel = self->v[kParamFuel];
-    int injectionInterval = self->v[kParamInjectionInterval];
-    int learningBars = self->v[kParamLearningBars];
-    
-    // Output pulses in LOCKED/INJECTING are treated as triggers (~10ms max).
-    // Passthrough (LEARNING) preserves incoming gate length by copying the input signal.
-    int baseTriggerLengthSamples = (int)((10.0f / 1000.0f) * NT_globals.sampleRate);
-    if (baseTriggerLengthSamples < 1) {
-        baseTriggerLengthSamples = 1;
-    }
-    const float TRIGGER_THRESHOLD = 1.0f;
-    const float TRIGGER_HIGH = 5.0f;
-    
-    // learningBars is the number of bars to observe; stability is checked across consecutive bar pairs.
-    // e.g. learningBars=2 -> require 1 stable comparison (2 bars total).
-    self->dtc->required_stable_bars = (learningBars > 1) ? (learningBars - 1) : 1;
-    
-    for (int frame = 0; frame < numFrames; frame++) {
-        const bool clockEnabled = (self->v[kParamClockSource] == 0) && (clockBus >= 0);
-        float clockValue = 0.0f;
-        if (clockEnabled) {
-            clockValue = busFrames[clockBus * numFrames + frame];
+    // Learning and injection run on the internal grid: PPQN describes the incoming clock.
+    grid.multiplier = effectiveClockMultiplier(grid.clockPpqn, clockMultValues[addedParam(self, kAddedParamClockMult)],
+                                               barLength);
+    grid.ppqn = grid.clockPpqn * grid.multiplier;
+    grid.ticksPerBar = grid.ppqn * barLength;
+    return grid;
+}
+
+// Carry the learned patterns over to a new tick grid. Locked groups whose every member
+// resamples losslessly stay locked; the others, and channels still learning, start over.
+static void resampleLearnedPatterns(_FuelInjectorAlgorithm* self, const TickGrid& grid) {
+    _FuelInjector_DTC* dtc = self->dtc;
+    PatternBits resampled[MAX_CHANNELS];
+    uint16_t hitCounts[MAX_CHANNELS];
+    uint8_t lossyLeaders = 0;
+
+    for (int c = 0; c < self->numChannels; ++c) {
+        const int leader = dtc->group_leader[c];
+        if (dtc->grid_ppqn == 0 || dtc->channel_state[leader] == LEARNING ||
+            !resampleBar(recordedBar(learnedPattern(self, c), 0), dtc->grid_ppqn, dtc->grid_ticks_per_bar,
+                         grid.ppqn, grid.ticksPerBar, resampled[c], hitCounts[c])) {
+            lossyLeaders |= (uint8_t)(1u << leader);
         }
-        const bool clockEdge =
-                clockEnabled && (clockValue >= TRIGGER_THRESHOLD) &&
-                (self->dtc->prev_clock_value < TRIGGER_THRESHOLD);
-        self->dtc->prev_clock_value = clockValue;
+    }
 
-        if (clockEnabled) {
-            self->dtc->samples_since_clock++;
-            if (clockEdge) {
-                self->dtc->last_clock_period_samples = self->dtc->samples_since_clock;
-                self->dtc->samples_since_clock = 0;
+    // A locked phrase carries over when all of its bars do. The grid change restarts the bar
+    // count, so the phrase restarts from its first bar.
+    for (int c = 0; c < self->numChannels; ++c) {
+        const int leader = dtc->group_leader[c];
+        if (dtc->phrase_length[leader] <= 1 || (lossyLeaders & (1u << leader))) continue;
+        LearnedPhrase& phrase = self->phrases[c];
+        for (int k = 0; k < dtc->phrase_length[leader]; k++) {
+            PatternBits bar;
+            if (!resampleBar(phrase.bars[k], dtc->grid_ppqn, dtc->grid_ticks_per_bar, grid.ppqn, grid.ticksPerBar,
+                             bar, phrase.hit_counts[k])) {
+                lossyLeaders |= (uint8_t)(1u << leader);
+                break;
             }
+            phrase.bars[k] = bar;
+        }
+        resampled[c] = phrase.bars[0];
+        hitCounts[c] = phrase.hit_counts[0];
+    }
+
+    for (int c = 0; c < self->numChannels; ++c) {
+        // Recordings on the old grid are meaningless on the new one.
+        channelPattern(self, c).stale_slots = (1 << 0) | (1 << 1);
+        barHistory(self, c).count = 0;
+        self->refinement[c].bars_left = 0;
+        if (lossyLeaders & (1u << dtc->group_leader[c])) {
+            dtc->channel_state[c] = LEARNING;
+            dtc->stable_bars_count[c] = 0;
+            dtc->bars_since_lock[c] = 0;
+            learnedPattern(self, c).stale_slots = (1 << 0) | (1 << 1);
         } else {
-            self->dtc->samples_since_clock = 0;
-            self->dtc->last_clock_period_samples = 0;
+            dtc->channel_state[c] = LOCKED;
+            loadBar(learnedPattern(self, c), resampled[c], hitCounts[c]);
+        }
+    }
+    dtc->state = summariseChannelStates(dtc->channel_state, self->numChannels);
+}
+
+// Move onto a new internal tick grid: learned patterns are resampled and the bar restarts.
+static void applyTickGrid(_FuelInjectorAlgorithm* self, const TickGrid& grid) {
+    _FuelInjector_DTC* dtc = self->dtc;
+    resampleLearnedPatterns(self, grid);
+    dtc->grid_ppqn = (uint16_t)grid.ppqn;
+    dtc->grid_ticks_per_bar = (uint16_t)grid.ticksPerBar;
+    refreshLearnedWindows(self, grid.ticksPerBar);
+
+    dtc->bar_counter = 0;
+    dtc->current_bar_position = 0;
+    dtc->clock_tick_counter = 0;
+    dtc->current_bar_index = 0;
+    dtc->is_injection_bar = false;
+    invalidateVariations(self);
+
+    for (int c = 0; c < self->numChannels; ++c) {
+        dtc->trigger_active_steps_remaining[c] = 0;
+        dtc->pending_count[c] = 0;
+    }
+}
+
+// Auto Grid: switch to the bar that fits the input's repeat `period` (in clock pulses) and,
+// when resets are patched, their `span`. The current bar stays while it already fits.
+// Returns whether the grid changed; the new bar starts at the next clock pulse.
+static bool inferTickGrid(_FuelInjectorAlgorithm* self, int period, int span) {
+    _FuelInjector_DTC* dtc = self->dtc;
+    const TickGrid current = resolveTickGrid(self);
+    const int currentPulses = current.ticksPerBar / current.multiplier;
+    if (span > 0 ? span % currentPulses == 0
+                 : (currentPulses % period == 0 || period % currentPulses == 0)) {
+        // A repeat over several whole bars is a phrase, and learned as one.
+        return false;
+    }
+    int ppqnIndex;
+    int barLength;
+    if (!nearestBarGrid(period, span, currentPulses, ppqnValues, (int)(sizeof(ppqnValues) / sizeof(ppqnValues[0])),
+                        self->v[kParamPPQN], ppqnIndex, barLength)) {
+        return false;
+    }
+    dtc->inferred_ppqn_index = (uint8_t)ppqnIndex;
+    dtc->inferred_bar_length = (uint8_t)barLength;
+    const TickGrid grid = resolveTickGrid(self);
+    applyTickGrid(self, grid);
+    dtc->clock.multiplier = (uint8_t)grid.multiplier;
+    dtc->clock.ticks_emitted = (uint8_t)grid.multiplier;
+    return true;
+}
+
+// Auto Grid from the input alone: the period of the hits seen on every channel.
+static void inferGridFromHits(_FuelInjectorAlgorithm* self) {
+    uint32_t window[ONSET_HISTORY_WORDS];
+    const int count = onsetWindow(self->onsets, window);
+    const int period = repeatPeriod(window, count, MAX_TICKS_PER_BAR, SIMILARITY_THRESHOLD);
+    if (period > 0) {
+        inferTickGrid(self, period, 0);
+    }
+}
+
+static void fuel_injector_parameter_changed(_NT_algorithm* self_base, int p_idx) {
+    _FuelInjectorAlgorithm* self = static_cast<_FuelInjectorAlgorithm*>(self_base);
+    
+    if (p_idx == kParamPPQN || p_idx == kParamBarLength ||
+        p_idx == addedParamIndex(self->numChannels, kAddedParamClockMult) ||
+        p_idx == addedParamIndex(self->numChannels, kAddedParamAutoGrid)) {
+        const TickGrid grid = resolveTickGrid(self);
+        if (grid.ppqn == self->dtc->grid_ppqn && grid.ticksPerBar == self->dtc->grid_ticks_per_bar) {
+            // Same internal grid (e.g. a Clock Mult change absorbed by the cap).
+            return;
         }
+        applyTickGrid(self, grid);
+        self->dtc->samples_since_clock = 0;
+        self->dtc->samples_since_tick = 0;
+        self->dtc->last_clock_period_samples = 0;
+        resetClockTracker(self->dtc->clock, self->dtc->clock.multiplier);
+    } else if (p_idx == addedParamIndex(self->numChannels, kAddedParamTolerance)) {
+        refreshLearnedWindows(self, self->dtc->grid_ticks_per_bar);
+    } else if (p_idx == kParamFuel ||
+               (p_idx >= kParamProbMicrotiming && p_idx <= kParamProbPolyrhythm)) {
+        // Variations were rendered with the old settings.
+        invalidateVariations(self);
+    }
+}
 
-        float resetValue = 0.0f;
-        if (resetBus >= 0) {
-            resetValue = busFrames[resetBus * numFrames + frame];
+// Passthrough on normal bars; only generate triggers on injection bars. Returns a mask of
+// the channels currently playing an injection.
+static inline uint8_t playbackChannels(const _FuelInjectorAlgorithm* self, int fuel, bool clockEnabled) {
+    if (fuel <= 0 || !clockEnabled || self->learned_patterns == nullptr || self->output_events == nullptr) {
+        return 0;
+    }
+    uint8_t mask = 0;
+    for (int c = 0; c < self->numChannels; ++c) {
+        if (self->dtc->channel_state[c] == INJECTING) {
+            mask |= (uint8_t)(1u << c);
         }
-        const bool resetEdge =
-                (resetBus >= 0) && (resetValue >= TRIGGER_THRESHOLD) &&
-                (self->dtc->prev_reset_value < TRIGGER_THRESHOLD);
-        self->dtc->prev_reset_value = resetValue;
+    }
+    return mask;
+}
 
-        if (resetEdge) {
-            self->dtc->state = LEARNING;
-            self->dtc->bar_counter = 0;
-            self->dtc->bars_since_lock = 0;
-            self->dtc->samples_since_clock = 0;
-            self->dtc->last_clock_period_samples = 0;
-            self->dtc->current_bar_position = 0;
-            self->dtc->clock_tick_counter = 0;
-            self->dtc->current_bar_index = 0;
-            self->dtc->stable_bars_count = 0;
-            self->dtc->is_injection_bar = false;
+// Per-channel routing resolved once per block so the frame loop never decodes parameters.
+struct ChannelRoute {
+    const float* in;    // trigger input column, nullptr when unpatched
+    float* out;         // trigger output column, nullptr when unpatched
+    bool replace;       // output mode: replace (true) or add (false)
+    bool inPlace;       // output shares the input bus (covers the in==out add-mode alias)
+};
 
-            for (int c = 0; c < self->numChannels; ++c) {
-                memset(&self->patterns[c], 0, sizeof(ChannelPattern));
-                memset(&self->learned_patterns[c], 0, sizeof(ChannelPattern));
-                self->dtc->trigger_active_steps_remaining[c] = 0;
-            }
+static void buildChannelRoutes(const _FuelInjectorAlgorithm* self, float* busFrames, int numFrames,
+                               ChannelRoute* routes) {
+    for (int c = 0; c < self->numChannels; ++c) {
+        int base = kNumSharedParams + c * kParamsPerChannel;
+        int trigInBus = self->v[base + kChannelParamTrigIn] - 1;
+        int trigOutBus = self->v[base + kChannelParamTrigOut] - 1;
+
+        ChannelRoute& route = routes[c];
+        route.in = (trigInBus >= 0) ? busFrames + trigInBus * numFrames : nullptr;
+        route.out = (trigOutBus >= 0) ? busFrames + trigOutBus * numFrames : nullptr;
+        route.replace = self->v[base + kChannelParamTrigOutMode] != 0;
+        route.inPlace = (trigInBus >= 0) && (trigOutBus == trigInBus);
+    }
+}
+
+// Render frames [start, end) of one channel: passthrough on normal bars, trigger pulses
+// (counted down from `remaining`) while injection playback is active.
+static void renderChannel(const ChannelRoute& route, uint16_t& remaining, float level, int start, int end,
+                          bool playbackActive) {
+    float* out = route.out;
+
+    if (playbackActive) {
+        int highEnd = end;
+        if (highEnd - start > remaining) {
+            highEnd = start + remaining;
         }
+        remaining = (uint16_t)(remaining - (highEnd - start));
 
-        bool clockTick = false;
-        int tickPos = static_cast<int>(self->dtc->current_bar_position);
-        if (clockEdge) {
-            clockTick = true;
-            tickPos = static_cast<int>(self->dtc->clock_tick_counter);
-            self->dtc->current_bar_position = static_cast<uint16_t>(tickPos);
+        if (!out) {
+            return;
         }
-        
-        // Process each channel's trigger input/output
-        for (int c = 0; c < self->numChannels; ++c) {
-            int base = kNumSharedParams + c * kParamsPerChannel;
-            int trigInBus = self->v[base + kChannelParamTrigIn] - 1;
-            int trigOutBus = self->v[base + kChannelParamTrigOut] - 1;
-            bool replaceMode = self->v[base + kChannelParamTrigOutMode];
-            
-            float trigInValue = 0.0f;
-            if (trigInBus >= 0) {
-                trigInValue = busFrames[trigInBus * numFrames + frame];
-            }
-            float* trigOut =
-                    (trigOutBus >= 0) ? &busFrames[trigOutBus * numFrames + frame] : nullptr;
-            
-            bool triggerDetected = (trigInValue >= TRIGGER_THRESHOLD && 
-                                   self->dtc->prev_trigger_value[c] < TRIGGER_THRESHOLD);
-            
-            // Record hits relative to the most recent clock tick; do not require the trigger
-            // to coincide sample-exactly with the clock edge.
-            if (triggerDetected) {
-                if (tickPos >= 0 && tickPos < ticksPerBar) {
-                    ChannelPattern& p = self->patterns[c];
-                    if (p.hit_positions_bar1[tickPos] == 0) {
-                        recordHit(p, 0, tickPos);
-                    }
-                }
+        if (route.replace) {
+            for (int f = start; f < highEnd; f++) out[f] = level;
+            for (int f = highEnd; f < end; f++) out[f] = 0.0f;
+        } else {
+            for (int f = start; f < highEnd; f++) out[f] += level;
+        }
+        return;
+    }
+
+    if (!out || route.inPlace) {
+        // Copying a bus onto itself is a no-op; this also avoids doubling in add mode.
+        return;
+    }
+    const float* in = route.in;
+    if (!in) {
+        if (route.replace) {
+            for (int f = start; f < end; f++) out[f] = 0.0f;
+        }
+        return;
+    }
+    if (route.replace) {
+        for (int f = start; f < end; f++) out[f] = in[f];
+    } else {
+        for (int f = start; f < end; f++) out[f] += in[f];
+    }
+}
+
+// Sub-tick microtiming for coarse clocks, where a whole-tick shift would be a 1/16th or more.
+// Hits keep their order relative to the original neighbours.
+static void applySubTickMicrotiming(_FuelInjectorAlgorithm* self, uint8_t strength, int ppqn, int ticksPerBar,
+                                   const HitIndex& hits, PatternBits& out, OffGridHits& offGrid) {
+    const int fineRange = ppqn * SUBTICKS_PER_TICK / 4; // +/- 1/16th at full strength
+    int maxShift = (fineRange * (int)strength + 99) / 100;
+    if (maxShift < 1) maxShift = 1;
+
+    for (int k = 0; k < hits.count; k++) {
+        const int i = hits.positions[k];
+        const int prev = (k > 0) ? hits.positions[k - 1] : -1;
+        const int next = (k + 1 < hits.count) ? hits.positions[k + 1] : -1;
+        const bool anchored = (i == 0) || ((i % ppqn) == 0 && strength < 80);
+        if (!anchored && rollPercent(strength, self->dtc->prng)) {
+            const int shift = (int)(self->dtc->prng.next() % (uint32_t)(maxShift * 2 + 1)) - maxShift;
+            const int32_t pos = i * SUBTICKS_PER_TICK + shift;
+            const bool afterPrev = (prev < 0) ? (pos >= 0) : (pos > prev * SUBTICKS_PER_TICK);
+            const bool beforeNext = (next < 0) ? (pos < ticksPerBar * SUBTICKS_PER_TICK) : (pos < next * SUBTICKS_PER_TICK);
+            if (shift != 0 && afterPrev && beforeNext) {
+                out.reset(i);
+                placeFineHit(&out, &offGrid, (uint32_t)pos);
             }
-            
-            self->dtc->prev_trigger_value[c] = trigInValue;
-            
-            // Passthrough on normal bars; only generate triggers on injection bars.
-            const bool injectionPlaybackActive =
-                    (fuel > 0) &&
-                    (self->dtc->state == INJECTING) &&
-                    clockEnabled &&
-                    (self->learned_patterns != nullptr) &&
-                    (self->output_patterns != nullptr);
-
-            if (injectionPlaybackActive) {
-                if (clockTick) {
-                    bool hit = false;
-                    if (tickPos >= 0 && tickPos < ticksPerBar) {
-                        hit = self->output_patterns[c][tickPos];
-                    }
-                    if (hit) {
-                        int triggerLengthSamples = baseTriggerLengthSamples;
-                        uint32_t clockPeriodSamples = self->dtc->last_clock_period_samples;
-                        if (clockPeriodSamples > 0) {
-                            uint32_t maxLen = clockPeriodSamples / 2;
-                            if (maxLen < 1) {
-                                maxLen = 1;
-                            }
-                            if ((uint32_t)triggerLengthSamples > maxLen) {
-                                triggerLengthSamples = (int)maxLen;
-                            }
-                        }
-                        self->dtc->trigger_active_steps_remaining[c] = (uint16_t)triggerLengthSamples;
-                    }
-                }
+        }
+    }
+}
 
-                bool shouldOutput = self->dtc->trigger_active_steps_remaining[c] > 0;
-                if (shouldOutput) {
-                    self->dtc->trigger_active_steps_remaining[c]--;
+// Build one channel's variation of its learned bar `source` for an injection bar. Hits that
+// fall between clock ticks go to `offGrid`.
+static void generateInjection(_FuelInjectorAlgorithm* self, int c, const PatternBits& source, int ppqn,
+                              int ticksPerBar, int fuel, PatternBits& out, OffGridHits& offGrid) {
+    const HitIndex& hits = learnedHitIndex(self, c, source, ppqn, ticksPerBar);
+    out = hits.bar;
+    offGrid.count = 0;
+
+    uint8_t probMicrotiming = self->v[kParamProbMicrotiming];
+    uint8_t probOmission = self->v[kParamProbOmission];
+    uint8_t probRoll = self->v[kParamProbRoll];
+    uint8_t probDensity = self->v[kParamProbDensity];
+    uint8_t probPermutation = self->v[kParamProbPermutation];
+    uint8_t probPolyrhythm = self->v[kParamProbPolyrhythm];
+
+    if (shouldApplyInjection(probMicrotiming, fuel, self->dtc->prng)) {
+        const uint8_t strength = scaledPercent(probMicrotiming, (uint8_t)fuel);
+        if (strength > 0 && calculateMicrotimingRange(ppqn) < 4) {
+            applySubTickMicrotiming(self, strength, ppqn, ticksPerBar, hits, out, offGrid);
+        } else if (strength > 0) {
+            const int baseRange = calculateMicrotimingRange(ppqn); // +/- 1/16th at full strength
+            int maxShift = (baseRange * (int)strength + 99) / 100;
+            if (maxShift < 1) maxShift = 1;
+            if (maxShift > baseRange) maxShift = baseRange;
+
+            PatternBits modified = out;
+
+            for (int k = 0; k < hits.count; k++) {
+                const int i = hits.positions[k];
+                if (i == 0) {
+                    continue; // keep bar downbeat stable
+                }
+                if ((i % ppqn) == 0 && strength < 80) {
+                    continue; // keep beat downbeats stable at lower strengths
+                }
+                if (!rollPercent(strength, self->dtc->prng)) {
+                    continue;
                 }
 
-                float outputValue = shouldOutput ? TRIGGER_HIGH : 0.0f;
-                if (trigOut) {
-                    if (replaceMode) {
-                        *trigOut = outputValue;
-                    } else {
-                        *trigOut += outputValue;
-                    }
+                int shift = (int)(self->dtc->prng.next() % (uint32_t)(maxShift * 2 + 1)) - maxShift;
+                if (shift == 0) {
+                    continue;
                 }
-            } else {
-                if (trigOut) {
-                    if (!replaceMode && trigOutBus == trigInBus) {
-                        // Avoid doubling when input and output share a bus in add mode.
-                        *trigOut = trigInValue;
-                    } else if (replaceMode) {
-                        *trigOut = trigInValue;
-                    } else {
-                        *trigOut += trigInValue;
-                    }
+
+                int adjacent =
+                        (k > 0 && hits.positions[k - 1] == i - 1) ? i - 1 :
+                        (k + 1 < hits.count && hits.positions[k + 1] == i + 1) ? i + 1 : -1;
+                int newPos = applyMicrotimingShift(i, shift, adjacent);
+                if (newPos < 0) newPos = 0;
+                if (newPos >= ticksPerBar) newPos = ticksPerBar - 1;
+
+                if (newPos != i && !modified.test(newPos)) {
+                    modified.reset(i);
+                    modified.set(newPos);
                 }
             }
+
+            out = modified;
         }
+    }
 
-        // Advance clock tick counter and handle end-of-bar transitions.
-        bool barBoundary = false;
-        FuelInjectorState endingState = self->dtc->state;
-        if (clockTick) {
-            self->dtc->clock_tick_counter++;
-            if (self->dtc->clock_tick_counter >= (uint32_t)ticksPerBar) {
-                self->dtc->clock_tick_counter = 0;
-                self->dtc->bar_counter++;
-                self->dtc->current_bar_position = 0;
-                barBoundary = true;
+    if (shouldApplyInjection(probOmission, fuel, self->dtc->prng)) {
+        const uint8_t strength = scaledPercent(probOmission, (uint8_t)fuel);
+        const uint8_t depth = easeInDepth(strength);
+        forEachOmittedHit(hits, depth, &self->dtc->prng, [&](uint16_t tick) { out.reset(tick); });
+    }
+
+    if (shouldApplyInjection(probRoll, fuel, self->dtc->prng)) {
+        const uint8_t strength = scaledPercent(probRoll, (uint8_t)fuel);
+        forEachRolledHit(hits, strength, &self->dtc->prng, [&](uint16_t tick, uint8_t subdivisions) {
+            applyRoll(&out, tick, subdivisions, ppqn, &offGrid);
+        });
+    }
+
+    if (shouldApplyInjection(probDensity, fuel, self->dtc->prng)) {
+        uint8_t burstBeatIndices[MAX_BAR_QUARTERS];
+        uint8_t burstCount = 0;
+        const uint8_t strength = scaledPercent(probDensity, (uint8_t)fuel);
+        selectBeatsForDensityBurst(hits, burstBeatIndices, &burstCount, strength, &self->dtc->prng);
+        applyDensityBurstInjection(&out, burstBeatIndices, burstCount, ppqn, &offGrid);
+    }
+
+    if (shouldApplyInjection(probPermutation, fuel, self->dtc->prng)) {
+        const uint8_t strength = scaledPercent(probPermutation, (uint8_t)fuel);
+        const uint8_t depth = easeInDepth(strength);
+
+        const uint16_t eighthNoteTicks = (ppqn >= 2) ? (uint16_t)(ppqn / 2) : 0;
+        if (eighthNoteTicks > 0) {
+            uint8_t segmentCount = (uint8_t)(ticksPerBar / (int)eighthNoteTicks);
+            if (segmentCount > 16) {
+                segmentCount = 16;
             }
-        }
 
-        if (barBoundary) {
-            // Learning: check whether the last two bars were similar enough to lock.
-            if (endingState == LEARNING) {
-                float minSimilarity = 100.0f;
-                for (int c = 0; c < self->numChannels; ++c) {
-                    float sim = calculatePatternSimilarity(self->patterns[c]);
-                    if (sim < minSimilarity) minSimilarity = sim;
+            if (segmentCount > 2 && depth >= 25) {
+                uint8_t permutation[16];
+                for (uint8_t i = 0; i < segmentCount; i++) {
+                    permutation[i] = i;
                 }
 
-                const float SIMILARITY_THRESHOLD = 90.0f;
-                if (minSimilarity >= SIMILARITY_THRESHOLD) {
-                    self->dtc->stable_bars_count++;
-                    if (self->dtc->stable_bars_count >= self->dtc->required_stable_bars) {
-                        self->dtc->state = LOCKED;
-                        self->dtc->bars_since_lock = 0;
-                        for (int c = 0; c < self->numChannels; ++c) {
-                            // Snapshot the just-completed bar as the learned pattern.
-                            memset(&self->learned_patterns[c], 0, sizeof(ChannelPattern));
-                            memcpy(self->learned_patterns[c].hit_positions_bar1,
-                                   self->patterns[c].hit_positions_bar1,
-                                   sizeof(self->learned_patterns[c].hit_positions_bar1));
-                            self->learned_patterns[c].hit_count_bar1 = self->patterns[c].hit_count_bar1;
+                const uint8_t half = (segmentCount >= 8) ? (uint8_t)(segmentCount / 2) : 0;
+
+                if (depth >= 70) {
+                    // High depth: full shuffle (anchored downbeat/midpoint) from the helper.
+                    generatePermutation(permutation, segmentCount, &self->dtc->prng);
+                } else {
+                    // Medium depth: a few local adjacent swaps within halves to keep it readable.
+                    uint8_t swapCount = (uint8_t)(1 + (uint8_t)((depth - 25) / 25)); // 1..2 for depth 25..74
+                    if (swapCount > 4) swapCount = 4;
+
+                    for (uint8_t s = 0; s < swapCount; s++) {
+                        uint8_t start = 1;
+                        uint8_t end = segmentCount;
+
+                        if (segmentCount >= 8) {
+                            bool useFirstHalf = (self->dtc->prng.next() % 2) == 0;
+                            start = useFirstHalf ? (uint8_t)1 : (uint8_t)(half + 1);
+                            end = useFirstHalf ? half : segmentCount;
+                        }
+
+                        if (end > start + 1) {
+                            uint8_t a = (uint8_t)(start + (self->dtc->prng.next() % (uint32_t)(end - start - 1)));
+                            uint8_t b = (uint8_t)(a + 1);
+
+                            if (segmentCount >= 8 && (a == half || b == half)) {
+                                continue; // keep midpoint anchor
+                            }
+
+                            uint8_t tmp = permutation[a];
+                            permutation[a] = permutation[b];
+                            permutation[b] = tmp;
                         }
                     }
-                } else {
-                    self->dtc->stable_bars_count = 0;
                 }
-            } else {
-                // LOCKED/INJECTING: monitor for input pattern changes to trigger re-learning.
-                bool patternChanged = false;
-                for (int c = 0; c < self->numChannels; ++c) {
-                    if (detectPatternChange(self->learned_patterns[c], self->patterns[c])) {
-                        patternChanged = true;
-                        break;
-                    }
+
+                PatternBits permutedPattern;
+                applyPermutationInjection(&out, &permutedPattern, permutation, (uint16_t)ppqn, (uint16_t)ticksPerBar);
+                out = permutedPattern;
+                permuteOffGridHits(&offGrid, permutation, (uint16_t)ppqn, (uint16_t)ticksPerBar);
+            }
+        }
+    }
+
+    if (shouldApplyInjection(probPolyrhythm, fuel, self->dtc->prng)) {
+        const uint8_t strength = scaledPercent(probPolyrhythm, (uint8_t)fuel);
+        const uint8_t depth = easeInDepth(strength);
+
+        // Polyrhythm is structurally heavy; only apply at higher depths.
+        if (depth >= 50) {
+            uint8_t polyType = 3;
+            if (depth > 70) {
+                uint8_t chance5 = (uint8_t)(((uint16_t)(depth - 70) * 100) / 30); // 0..100
+                if (rollPercent(chance5, self->dtc->prng)) {
+                    polyType = 5;
                 }
+            }
 
-                if (patternChanged) {
-                    self->dtc->state = LEARNING;
-                    self->dtc->stable_bars_count = 0;
-                    self->dtc->bars_since_lock = 0;
-                    self->dtc->is_injection_bar = false;
-                    for (int c = 0; c < self->numChannels; ++c) {
-                        self->dtc->trigger_active_steps_remaining[c] = 0;
+            const uint16_t barTicks = (uint16_t)ticksPerBar;
+            // Exact spacing in sub-ticks, so e.g. 5 over a 16-tick bar is not rounded to the grid.
+            const uint32_t spacing = (uint32_t)barTicks * SUBTICKS_PER_TICK / polyType;
+            if (spacing > 0) {
+                const uint8_t maxExtras = (uint8_t)(polyType - 1);
+                uint8_t extras = (uint8_t)(((uint16_t)depth * maxExtras) / 100); // 0..maxExtras
+                if (extras > maxExtras) extras = maxExtras;
+
+                if (extras > 0) {
+                    uint8_t candidates[4];
+                    for (uint8_t i = 0; i < maxExtras; i++) {
+                        candidates[i] = (uint8_t)(i + 1);
                     }
-                } else {
-                    // Completed one bar while locked/injecting.
-                    if (endingState == LOCKED || endingState == INJECTING) {
-                        self->dtc->bars_since_lock++;
+                    for (uint8_t i = (uint8_t)(maxExtras - 1); i > 0; i--) {
+                        uint8_t j = (uint8_t)(self->dtc->prng.next() % (i + 1));
+                        uint8_t tmp = candidates[i];
+                        candidates[i] = candidates[j];
+                        candidates[j] = tmp;
                     }
-
-                    // Injection bar finished -> return to locked for the next bar.
-                    if (endingState == INJECTING) {
-                        self->dtc->state = LOCKED;
-                        self->dtc->is_injection_bar = false;
-                        for (int c = 0; c < self->numChannels; ++c) {
-                            self->dtc->trigger_active_steps_remaining[c] = 0;
+                    for (uint8_t i = 0; i < extras; i++) {
+                        const uint32_t pos = candidates[i] * spacing;
+                        if (pos < (uint32_t)barTicks * SUBTICKS_PER_TICK) {
+                            placeFineHit(&out, &offGrid, pos);
                         }
                     }
+                }
+            }
+        }
+    }
+}
 
-                    // Schedule an injection for the *next* bar.
-                    // We use (bar_counter + 1) as the next bar number (1-indexed).
-                    if (fuel > 0 &&
-                        self->dtc->state == LOCKED &&
-                        shouldInjectThisBar(self->dtc->bar_counter + 1, injectionInterval)) {
-                        self->dtc->state = INJECTING;
-                        self->dtc->is_injection_bar = true;
-
-                        for (int c = 0; c < self->numChannels; ++c) {
-                            for (int i = 0; i < ticksPerBar; i++) {
-                                self->output_patterns[c][i] = self->learned_patterns[c].hit_positions_bar1[i] > 0;
-                            }
+static void renderVariation(_FuelInjectorAlgorithm* self, int c, int slot, int phraseBar, int ppqn, int ticksPerBar,
+                            int fuel) {
+    PatternBits bits;
+    OffGridHits offGrid;
+    generateInjection(self, c, variationSource(self, c, phraseBar), ppqn, ticksPerBar, fuel, bits, offGrid);
+    compileEvents(bits, ticksPerBar, variationEvents(self, c, slot), &offGrid);
+}
 
-                            uint8_t probMicrotiming = self->v[kParamProbMicrotiming];
-                            uint8_t probOmission = self->v[kParamProbOmission];
-                            uint8_t probRoll = self->v[kParamProbRoll];
-                            uint8_t probDensity = self->v[kParamProbDensity];
-                            uint8_t probPermutation = self->v[kParamProbPermutation];
-	                            uint8_t probPolyrhythm = self->v[kParamProbPolyrhythm];
-
-	                            if (shouldApplyInjection(probMicrotiming, fuel, self->dtc->prng)) {
-	                                const uint8_t strength = scaledPercent(probMicrotiming, (uint8_t)fuel);
-	                                if (strength > 0) {
-	                                    const int baseRange = calculateMicrotimingRange(ppqn); // +/- 1/16th at full strength
-	                                    int maxShift = (baseRange * (int)strength + 99) / 100;
-	                                    if (maxShift < 1) maxShift = 1;
-	                                    if (maxShift > baseRange) maxShift = baseRange;
-
-	                                    bool original[MAX_TICKS_PER_BAR];
-	                                    bool modified[MAX_TICKS_PER_BAR];
-	                                    memcpy(original, self->output_patterns[c], ticksPerBar * sizeof(bool));
-	                                    memcpy(modified, original, ticksPerBar * sizeof(bool));
-
-	                                    for (int i = 0; i < ticksPerBar; i++) {
-	                                        if (!original[i]) {
-	                                            continue;
-	                                        }
-	                                        if (i == 0) {
-	                                            continue; // keep bar downbeat stable
-	                                        }
-	                                        if ((i % ppqn) == 0 && strength < 80) {
-	                                            continue; // keep beat downbeats stable at lower strengths
-	                                        }
-	                                        if (!rollPercent(strength, self->dtc->prng)) {
-	                                            continue;
-	                                        }
-
-	                                        int shift = (int)(self->dtc->prng.next() % (uint32_t)(maxShift * 2 + 1)) - maxShift;
-	                                        if (shift == 0) {
-	                                            continue;
-	                                        }
-
-	                                        int adjacent =
-	                                                (i > 0 && original[i - 1]) ? i - 1 :
-	                                                (i < ticksPerBar - 1 && original[i + 1]) ? i + 1 : -1;
-	                                        int newPos = applyMicrotimingShift(i, shift, adjacent);
-	                                        if (newPos < 0) newPos = 0;
-	                                        if (newPos >= ticksPerBar) newPos = ticksPerBar - 1;
-
-	                                        if (newPos != i && !modified[newPos]) {
-	                                            modified[i] = false;
-	                                            modified[newPos] = true;
-	                                        }
-	                                    }
-
-	                                    memcpy(self->output_patterns[c], modified, ticksPerBar * sizeof(bool));
-	                                }
-	                            }
-
-	                            if (shouldApplyInjection(probOmission, fuel, self->dtc->prng)) {
-	                                uint8_t omitIndices[MAX_TICKS_PER_BAR];
-	                                uint8_t omitCount = 0;
-	                                const uint8_t strength = scaledPercent(probOmission, (uint8_t)fuel);
-	                                const uint8_t depth = easeInDepth(strength);
-	                                selectHitsForOmission(&self->learned_patterns[c], omitIndices, &omitCount, depth, &self->dtc->prng, ticksPerBar);
-	                                applyOmissionInjection(self->output_patterns[c], omitIndices, omitCount);
-	                            }
-
-	                            if (shouldApplyInjection(probRoll, fuel, self->dtc->prng)) {
-	                                uint8_t rollIndices[MAX_TICKS_PER_BAR];
-	                                uint8_t rollCount = 0;
-	                                uint8_t rollSubdivisions[MAX_TICKS_PER_BAR];
-	                                const uint8_t strength = scaledPercent(probRoll, (uint8_t)fuel);
-	                                selectHitsForRoll(&self->learned_patterns[c], rollIndices, &rollCount, rollSubdivisions, strength, &self->dtc->prng, ticksPerBar);
-	                                applyRollInjection(self->output_patterns[c], rollIndices, rollCount, rollSubdivisions, ppqn);
-	                            }
-
-	                            if (shouldApplyInjection(probDensity, fuel, self->dtc->prng)) {
-	                                uint8_t burstBeatIndices[MAX_TICKS_PER_BAR / 48];
-	                                uint8_t burstCount = 0;
-	                                const uint8_t strength = scaledPercent(probDensity, (uint8_t)fuel);
-	                                selectBeatsForDensityBurst(&self->learned_patterns[c], burstBeatIndices, &burstCount, strength, &self->dtc->prng, ticksPerBar, ppqn);
-	                                applyDensityBurstInjection(self->output_patterns[c], burstBeatIndices, burstCount, ppqn);
-	                            }
-
-		                            if (shouldApplyInjection(probPermutation, fuel, self->dtc->prng)) {
-		                                const uint8_t strength = scaledPercent(probPermutation, (uint8_t)fuel);
-		                                const uint8_t depth = easeInDepth(strength);
-
-		                                const uint16_t eighthNoteTicks = (ppqn >= 2) ? (uint16_t)(ppqn / 2) : 0;
-		                                if (eighthNoteTicks > 0) {
-		                                    uint8_t segmentCount = (uint8_t)(ticksPerBar / (int)eighthNoteTicks);
-		                                    if (segmentCount > 16) {
-		                                        segmentCount = 16;
-		                                    }
-
-		                                    if (segmentCount > 2 && depth >= 25) {
-		                                        uint8_t permutation[16];
-		                                        for (uint8_t i = 0; i < segmentCount; i++) {
-		                                            permutation[i] = i;
-		                                        }
-
-		                                        const uint8_t half = (segmentCount >= 8) ? (uint8_t)(segmentCount / 2) : 0;
-
-		                                        if (depth >= 70) {
-		                                            // High depth: full shuffle (anchored downbeat/midpoint) from the helper.
-		                                            generatePermutation(permutation, segmentCount, &self->dtc->prng);
-		                                        } else {
-		                                            // Medium depth: a few local adjacent swaps within halves to keep it readable.
-		                                            uint8_t swapCount = (uint8_t)(1 + (uint8_t)((depth - 25) / 25)); // 1..2 for depth 25..74
-		                                            if (swapCount > 4) swapCount = 4;
-
-		                                            for (uint8_t s = 0; s < swapCount; s++) {
-		                                                uint8_t start = 1;
-		                                                uint8_t end = segmentCount;
-
-		                                                if (segmentCount >= 8) {
-		                                                    bool useFirstHalf = (self->dtc->prng.next() % 2) == 0;
-		                                                    start = useFirstHalf ? (uint8_t)1 : (uint8_t)(half + 1);
-		                                                    end = useFirstHalf ? half : segmentCount;
-		                                                }
-
-		                                                if (end > start + 1) {
-		                                                    uint8_t a = (uint8_t)(start + (self->dtc->prng.next() % (uint32_t)(end - start - 1)));
-		                                                    uint8_t b = (uint8_t)(a + 1);
-
-		                                                    if (segmentCount >= 8 && (a == half || b == half)) {
-		                                                        continue; // keep midpoint anchor
-		                                                    }
-
-		                                                    uint8_t tmp = permutation[a];
-		                                                    permutation[a] = permutation[b];
-		                                                    permutation[b] = tmp;
-		                                                }
-		                                            }
-		                                        }
-
-		                                        bool permutedPattern[MAX_TICKS_PER_BAR];
-		                                        memset(permutedPattern, 0, ticksPerBar * sizeof(bool));
-		                                        applyPermutationInjection(self->output_patterns[c], permutedPattern, permutation, (uint16_t)ppqn, (uint16_t)ticksPerBar);
-		                                        memcpy(self->output_patterns[c], permutedPattern, ticksPerBar * sizeof(bool));
-		                                    }
-		                                }
-		                            }
-
-	                            if (shouldApplyInjection(probPolyrhythm, fuel, self->dtc->prng)) {
-	                                const uint8_t strength = scaledPercent(probPolyrhythm, (uint8_t)fuel);
-	                                const uint8_t depth = easeInDepth(strength);
-
-	                                // Polyrhythm is structurally heavy; only apply at higher depths.
-	                                if (depth >= 50) {
-	                                    uint8_t polyType = 3;
-	                                    if (depth > 70) {
-	                                        uint8_t chance5 = (uint8_t)(((uint16_t)(depth - 70) * 100) / 30); // 0..100
-	                                        if (rollPercent(chance5, self->dtc->prng)) {
-	                                            polyType = 5;
-	                                        }
-	                                    }
-
-	                                    const uint16_t barTicks = (uint16_t)ticksPerBar;
-	                                    const uint16_t spacing = (polyType > 0) ? (uint16_t)(barTicks / polyType) : 0;
-	                                    if (spacing > 0) {
-	                                        const uint8_t maxExtras = (uint8_t)(polyType - 1);
-	                                        uint8_t extras = (uint8_t)(((uint16_t)depth * maxExtras) / 100); // 0..maxExtras
-	                                        if (extras > maxExtras) extras = maxExtras;
-
-	                                        if (extras > 0) {
-	                                            uint8_t candidates[4];
-	                                            for (uint8_t i = 0; i < maxExtras; i++) {
-	                                                candidates[i] = (uint8_t)(i + 1);
-	                                            }
-	                                            for (uint8_t i = (uint8_t)(maxExtras - 1); i > 0; i--) {
-	                                                uint8_t j = (uint8_t)(self->dtc->prng.next() % (i + 1));
-	                                                uint8_t tmp = candidates[i];
-	                                                candidates[i] = candidates[j];
-	                                                candidates[j] = tmp;
-	                                            }
-	                                            for (uint8_t i = 0; i < extras; i++) {
-	                                                uint16_t pos = (uint16_t)(candidates[i] * spacing);
-	                                                if (pos < barTicks) {
-	                                                    self->output_patterns[c][pos] = true;
-	                                                }
-	                                            }
-	                                        }
-	                                    }
-	                                }
-	                            }
-	                        }
-	                    }
-	                }
-	            }
-
-            // Rotate the recording buffers for the next bar: bar1 -> bar2, clear bar1.
-            for (int c = 0; c < self->numChannels; ++c) {
-                shiftBarsForNewBar(self->patterns[c]);
+// Render one missing variation per block (round-robin over channels) while a pattern is
+// locked, so injection bars only have to pick a slot. A phrase's bank holds variations of
+// the bar that comes next, so it is ready when that bar starts.
+static void fillVariationBank(_FuelInjectorAlgorithm* self, int ppqn, int ticksPerBar, int fuel) {
+    _FuelInjector_DTC* dtc = self->dtc;
+    if (self->output_events == nullptr || fuel <= 0) {
+        return;
+    }
+    for (int n = 0; n < self->numChannels; ++n) {
+        const int c = dtc->gen_channel;
+        dtc->gen_channel = (uint8_t)((c + 1) % self->numChannels);
+        if (dtc->channel_state[c] != LOCKED && dtc->channel_state[c] != INJECTING) {
+            continue;
+        }
+        const int phraseBar = phraseBarIndex(self, c, dtc->bar_counter + 1);
+        if (phraseBar != dtc->bank_phrase_bar[c]) {
+            dtc->variation_ready[c] = 0;
+            dtc->bank_phrase_bar[c] = (int8_t)phraseBar;
+        }
+        // Never overwrite the slot that is playing right now.
+        const int busy = (dtc->channel_state[c] == INJECTING) ? dtc->active_variation[c] : -1;
+        for (int slot = 0; slot < VARIATION_BANK_SIZE; ++slot) {
+            if ((dtc->variation_ready[c] & (1u << slot)) || slot == busy) {
+                continue;
             }
+            renderVariation(self, c, slot, phraseBar, ppqn, ticksPerBar, fuel);
+            dtc->variation_ready[c] |= (uint8_t)(1u << slot);
+            return;
         }
     }
 }
 
-// Custom UI check
-static uint32_t fuel_injector_has_custom_ui(_NT_algorithm* self_base) {
-    // Return 0 for now (no custom UI overrides)
-    // Could return kNT_potButtonL | kNT_potButtonC | kNT_potButtonR to override pots
-    return 0;
+// Whether channel c's bank has a variation other than the one played last ready for the bar
+// about to start. A bank filled for another bar of the phrase (or before the phrase locked)
+// is emptied first.
+static bool injectionVariationReady(_FuelInjectorAlgorithm* self, int c) {
+    _FuelInjector_DTC* dtc = self->dtc;
+    const int phraseBar = phraseBarIndex(self, c, dtc->bar_counter);
+    if (phraseBar != dtc->bank_phrase_bar[c]) {
+        dtc->variation_ready[c] = 0;
+        dtc->bank_phrase_bar[c] = (int8_t)phraseBar;
+    }
+    return pickVariation(dtc->variation_ready[c], dtc->active_variation[c], 0) >= 0;
 }
 
-// Setup UI pots
-static void fuel_injector_setup_ui(_NT_algorithm* self_base, _NT_float3& pots) {
-    _FuelInjectorAlgorithm* self = static_cast<_FuelInjectorAlgorithm*>(self_base);
-    
-    // Map pot to Fuel parameter (0-100 -> 0.0-1.0)
-    pots[0] = self->v[kParamFuel] / 100.0f;
-    pots[1] = 0.0f;
-    pots[2] = 0.0f;
+// Select channel c's variation for the injection bar about to start (see
+// injectionVariationReady); nothing is rendered here.
+static void selectInjectionVariation(_FuelInjectorAlgorithm* self, int c) {
+    _FuelInjector_DTC* dtc = self->dtc;
+    dtc->active_variation[c] = (int8_t)pickVariation(dtc->variation_ready[c], dtc->active_variation[c],
+                                                     dtc->prng.next());
+    dtc->play_cursor[c] = 0;
 }
 
-// Custom UI handling
-static void fuel_injector_custom_ui(_NT_algorithm* self_base, const _NT_uiData& data) {
-    _FuelInjectorAlgorithm* self = static_cast<_FuelInjectorAlgorithm*>(self_base);
-    (void)self;
-    (void)data;
+// Similarity of `bar` to channel c's learned bar, compared the way the lock is monitored:
+// coarse locks on the 16th grid they were learned on, others within the Tolerance.
+static float lockedSimilarity(_FuelInjectorAlgorithm* self, int c, const PatternBits& bar, int ticksPerBar,
+                              int cellTicks) {
+    const PatternBits& learned = recordedBar(learnedPattern(self, c), 0);
+    if ((self->dtc->coarse_locked & (1u << c)) && cellTicks > 0) {
+        return coarseSimilarity(learned, bar, ticksPerBar, cellTicks);
+    }
+    return toleranceSimilarity(learned, bar, ticksPerBar, addedParam(self, kAddedParamTolerance));
 }
 
-// Draw custom display
-static bool fuel_injector_draw(_NT_algorithm* self_base) {
-    _FuelInjectorAlgorithm* self = static_cast<_FuelInjectorAlgorithm*>(self_base);
-    if (!self || !self->dtc) {
-        return false;
+// Whether the bar just recorded on locked channel c no longer matches its learned bar. Exact
+// comparisons use the counts kept while recording.
+static bool lockedPatternChanged(_FuelInjectorAlgorithm* self, int c, int ticksPerBar, int cellTicks) {
+    const ChannelPattern& incoming = channelPattern(self, c);
+    if (addedParam(self, kAddedParamTolerance) == 0 && !((self->dtc->coarse_locked & (1u << c)) && cellTicks > 0)) {
+        return detectPatternChange(recordedHitCount(learnedPattern(self, c), 0), recordedHitCount(incoming, 0),
+                                   recordedReferenceHits(incoming));
     }
+    return lockedSimilarity(self, c, recordedBar(incoming, 0), ticksPerBar, cellTicks) < SIMILARITY_THRESHOLD;
+}
 
-    const _FuelInjector_DTC* dtc = self->dtc;
-
-    const char* stateStr = "LEARN";
-    switch (dtc->state) {
-        case LEARNING: stateStr = "LEARN"; break;
-        case LOCKED: stateStr = "LOCK"; break;
-        case INJECTING: stateStr = "INJ"; break;
+// Fold the bar just played on locked channel c into its hit histogram and re-derive the
+// learned bar from it. A learned bar replaced since the last update (a new lock, a preset,
+// a grid change) restarts the histogram first.
+static void updateLearnedModel(_FuelInjectorAlgorithm* self, int c, int ticksPerBar) {
+    if (self->histograms == nullptr) {
+        return;
     }
+    HitHistogram& h = self->histograms[c];
+    ChannelPattern& learned = learnedPattern(self, c);
+    if (h.model != patternFingerprint(recordedBar(learned, 0))) {
+        seedHistogram(h, recordedBar(learned, 0));
+    }
+    updateHistogram(h, recordedBar(learned, 0), self->learned_window[c], recordedBar(channelPattern(self, c), 0),
+                    ticksPerBar, addedParam(self, kAddedParamTolerance));
+    PatternBits model;
+    thresholdHistogram(h, HISTOGRAM_THRESHOLD, model);
+    h.model = patternFingerprint(model);
+    if (!sameBits(model, recordedBar(learned, 0))) {
+        loadBar(learned, model, (uint16_t)countHits(model));
+        self->dtc->variation_ready[c] = 0;
+    }
+}
 
-    // Leave room for the host's parameter line (top of screen).
-    NT_drawText(2, 20, "Fuel Injector", 15, kNT_textLeft, kNT_textTiny);
-
-    char numBuf[12] = {0};
-    char lineBuf[32] = {0};
-
-    // State
-    NT_drawText(2, 28, stateStr, 15, kNT_textLeft, kNT_textTiny);
+// Keep channel c's learned groove in its cache as its lock ends. Only single-bar grooves are
+// kept: one bar of a phrase is no groove of its own.
+static void rememberLearnedGroove(_FuelInjectorAlgorithm* self, int c) {
+    const ChannelPattern& learned = learnedPattern(self, c);
+    if (self->groove_caches == nullptr || recordedHitCount(learned, 0) == 0 ||
+        self->dtc->phrase_length[self->dtc->group_leader[c]] > 1) {
+        return;
+    }
+    rememberGroove(self->groove_caches[c], recordedBar(learned, 0), recordedHitCount(learned, 0),
+                   self->dtc->grid_ppqn, self->dtc->grid_ticks_per_bar, (self->dtc->coarse_locked >> c) & 1);
+}
 
-    // Bar
-    int nlen = NT_intToString(numBuf, (int32_t)dtc->bar_counter);
-    int pos = 0;
-    const char* prefix = "Bar:";
-    while (prefix[pos] && pos < (int)sizeof(lineBuf) - 1) {
-        lineBuf[pos] = prefix[pos];
-        pos++;
+// The cached groove of channel c that `bar` repeats, compared the way that groove's lock was
+// monitored, or -1. An identical bar is found by its fingerprint alone.
+static int matchKnownGroove(_FuelInjectorAlgorithm* self, int c, const PatternBits& bar, int ppqn, int ticksPerBar,
+                            int cellTicks) {
+    if (self->groove_caches == nullptr) {
+        return -1;
     }
-    for (int i = 0; i < nlen && pos < (int)sizeof(lineBuf) - 1; i++) {
-        lineBuf[pos++] = numBuf[i];
+    const GrooveCache& cache = self->groove_caches[c];
+    const uint32_t fingerprint = patternFingerprint(bar);
+    int best = -1;
+    float bestSimilarity = SIMILARITY_THRESHOLD;
+    for (int i = 0; i < GROOVE_CACHE_SIZE; i++) {
+        const KnownGroove& e = cache.entries[i];
+        if (e.last_used == 0 || e.ppqn != ppqn || e.ticks_per_bar != ticksPerBar) {
+            continue;
+        }
+        if (e.fingerprint == fingerprint && sameBits(e.bits, bar)) {
+            return i;
+        }
+        const float similarity = (e.coarse && cellTicks > 0)
+            ? coarseSimilarity(e.bits, bar, ticksPerBar, cellTicks)
+            : toleranceSimilarity(e.bits, bar, ticksPerBar, addedParam(self, kAddedParamTolerance));
+        if (similarity >= bestSimilarity) {
+            bestSimilarity = similarity;
+            best = i;
+        }
     }
-    lineBuf[pos] = '\0';
-    NT_drawText(48, 28, lineBuf, 15, kNT_textLeft, kNT_textTiny);
+    return best;
+}
 
-    // Tick
+// Switching back to a groove seen before: when the bar just recorded on every member of the
+// group repeats one of its cached grooves, lock onto those at once instead of waiting for
+// Learn Bars. Silent members come along with an empty groove.
+static bool relockKnownGrooves(_FuelInjectorAlgorithm* self, int leader, int ppqn, int ticksPerBar, int cellTicks) {
+    _FuelInjector_DTC* dtc = self->dtc;
+    int8_t matches[MAX_CHANNELS];
+    bool found = false;
+    for (int c = leader; c < self->numChannels; ++c) {
+        if (dtc->group_leader[c] != leader) continue;
+        const ChannelPattern& p = channelPattern(self, c);
+        matches[c] = (int8_t)matchKnownGroove(self, c, recordedBar(p, 0), ppqn, ticksPerBar, cellTicks);
+        if (matches[c] < 0 && recordedHitCount(p, 0) > 0) {
+            return false;
+        }
+        found = found || matches[c] >= 0;
+    }
+    if (!found) {
+        return false;
+    }
+
+    for (int c = leader; c < self->numChannels; ++c) {
+        if (dtc->group_leader[c] != leader) continue;
+        ChannelPattern& learned = learnedPattern(self, c);
+        dtc->coarse_locked &= (uint8_t)~(1u << c);
+        if (matches[c] >= 0) {
+            GrooveCache& cache = self->groove_caches[c];
+            const KnownGroove& e = cache.entries[matches[c]];
+            loadBar(learned, e.bits, e.hit_count);
+            if (e.coarse) {
+                dtc->coarse_locked |= (uint8_t)(1u << c);
+            }
+            touchGroove(cache, matches[c]);
+        } else {
+            PatternBits silent = {};
+            loadBar(learned, silent, 0);
+        }
+        self->refinement[c].bars_left = 0;
+        dtc->variation_ready[c] = 0;
+    }
+    dtc->stable_bars_count[leader] = dtc->required_stable_bars;
+    dtc->bars_since_lock[leader] = 0;
+    dtc->phrase_length[leader] = 1;
+    return true;
+}
+
+// Phrase period detection, at every bar end: per period, count the consecutive bars in which
+// every member of a group repeated its bar from one period before.
+static void updatePhraseMatches(_FuelInjectorAlgorithm* self, int ticksPerBar) {
+    _FuelInjector_DTC* dtc = self->dtc;
+    if (self->bar_histories == nullptr) {
+        return;
+    }
+    for (int leader = 0; leader < self->numChannels; ++leader) {
+        if (dtc->group_leader[leader] != leader) continue;
+        for (int k = 0; k < PHRASE_PERIODS; k++) {
+            bool repeated = true;
+            for (int c = leader; c < self->numChannels && repeated; ++c) {
+                if (dtc->group_leader[c] != leader) continue;
+                const BarHistory& history = barHistory(self, c);
+                const int slot = historySlot(history, phrasePeriod(k));
+                repeated = slot >= 0 &&
+                    toleranceSimilarity(recordedBar(channelPattern(self, c), 0), history.bars[slot], ticksPerBar,
+                                        addedParam(self, kAddedParamTolerance)) >= SIMILARITY_THRESHOLD;
+            }
+            uint8_t& matches = dtc->phrase_matches[leader][k];
+            matches = repeated ? (uint8_t)(matches < 255 ? matches + 1 : matches) : 0;
+        }
+    }
+}
+
+// Make the bar of channel c's locked phrase that bar `bar_counter` plays its learned bar.
+static void loadPhraseBar(_FuelInjectorAlgorithm* self, int c) {
+    _FuelInjector_DTC* dtc = self->dtc;
+    const int length = dtc->phrase_length[dtc->group_leader[c]];
+    if (length <= 1) {
+        return;
+    }
+    const int index = (int)(dtc->bar_counter % (uint32_t)length);
+    const LearnedPhrase& phrase = self->phrases[c];
+    ChannelPattern& learned = learnedPattern(self, c);
+    // The variation bank is kept: it was filled for this bar ahead of time (see
+    // fillVariationBank).
+    if (!sameBits(recordedBar(learned, 0), phrase.bars[index])) {
+        loadBar(learned, phrase.bars[index], phrase.hit_counts[index]);
+    }
+}
+
+// Lock the group led by `leader` onto a phrase of several bars once a period detector has
+// seen it repeat (see detectedPhrase): the bar that just ended and the ones before it in the
+// bar history become the phrase. Returns whether the group locked.
+static bool lockDetectedPhrase(_FuelInjectorAlgorithm* self, int leader) {
+    _FuelInjector_DTC* dtc = self->dtc;
+    const int period = detectedPhrase(dtc->phrase_matches[leader], dtc->required_stable_bars);
+    if (period == 0 || self->phrases == nullptr) {
+        return false;
+    }
+    for (int c = leader; c < self->numChannels; ++c) {
+        if (dtc->group_leader[c] != leader) continue;
+        LearnedPhrase& phrase = self->phrases[c];
+        const BarHistory& history = barHistory(self, c);
+        const ChannelPattern& recorded = channelPattern(self, c);
+        // The bar k bars before the one now starting is bar (bar_counter - 1 - k) of the phrase.
+        for (int k = 0; k < period; k++) {
+            const int index = (int)((dtc->bar_counter - 1 - (uint32_t)k) % (uint32_t)period);
+            if (k == 0) {
+                phrase.bars[index] = recordedBar(recorded, 0);
+                phrase.hit_counts[index] = recordedHitCount(recorded, 0);
+            } else {
+                const int slot = historySlot(history, k);
+                phrase.bars[index] = history.bars[slot];
+                phrase.hit_counts[index] = history.hit_counts[slot];
+            }
+        }
+        dtc->coarse_locked &= (uint8_t)~(1u << c);
+        dtc->unlocked_this_bar &= (uint8_t)~(1u << c);
+        self->refinement[c].bars_left = 0;
+        dtc->variation_ready[c] = 0;
+    }
+    dtc->phrase_length[leader] = (uint8_t)period;
+    for (int c = leader; c < self->numChannels; ++c) {
+        if (dtc->group_leader[c] == leader) loadPhraseBar(self, c);
+    }
+    dtc->stable_bars_count[leader] = dtc->required_stable_bars;
+    dtc->bars_since_lock[leader] = 0;
+    return true;
+}
+
+// Bar phase recovery: when the bars of the locked channels only match their learned bars
+// rotated (a missed or late reset, dropped clock pulses), rotate the recordings into place
+// instead of relearning. Groups that dropped out of a lock in this bar or the one before
+// (the bar the phase slipped in matches neither way) take part too, and lock again. Slips
+// of up to a beat either way are recovered, which keeps the search at the bar end short.
+// Runs at the bar end, before the state machines see the bar, and returns the position the
+// next bar starts from (0 when the phase is kept).
+static int realignBarPhase(_FuelInjectorAlgorithm* self, int ppqn, int ticksPerBar) {
+    const int cellTicks = coarseCellTicks(ppqn);
+    _FuelInjector_DTC* dtc = self->dtc;
+    const uint8_t unlocked = dtc->unlocked_this_bar | dtc->unlocked_last_bar;
+    uint8_t members = 0;
+    bool changed = false;
+    PatternBits incoming = {};
+    PatternBits expected = {};
+    for (int c = 0; c < self->numChannels; ++c) {
+        const bool isLocked = dtc->channel_state[c] != LEARNING;
+        if ((!isLocked && !(unlocked & (1u << c))) || recordedHitCount(learnedPattern(self, c), 0) == 0) {
+            continue;
+        }
+        members |= (uint8_t)(1u << c);
+        changed = changed || !isLocked || lockedPatternChanged(self, c, ticksPerBar, cellTicks);
+        const PatternBits& bar = recordedBar(channelPattern(self, c), 0);
+        for (int i = 0; i < PATTERN_WORDS; i++) {
+            incoming.words[i] |= bar.words[i];
+            expected.words[i] |= self->learned_window[c].words[i];
+        }
+    }
+    if (!changed) {
+        return 0;
+    }
+
+    // One correlation over all the channels picks the rotation; each must then match.
+    int matched;
+    const int shift = bestRotation(incoming, expected, ticksPerBar, ppqn, matched);
+    if (shift == 0) {
+        return 0;
+    }
+    PatternBits rotated;
+    for (int c = 0; c < self->numChannels; ++c) {
+        if (!(members & (1u << c))) continue;
+        rotateBits(recordedBar(channelPattern(self, c), 0), shift, ticksPerBar, rotated);
+        if (lockedSimilarity(self, c, rotated, ticksPerBar, cellTicks) < SIMILARITY_THRESHOLD) {
+            return 0;
+        }
+    }
+
+    for (int c = 0; c < self->numChannels; ++c) {
+        ChannelPattern& p = channelPattern(self, c);
+        rotateRecordedBars(p, shift, ticksPerBar);
+        p.reference_hits = (uint16_t)countCommonHits(recordedBar(p, 0), self->learned_window[c]);
+        if ((members & (1u << c)) && dtc->channel_state[c] == LEARNING) {
+            // The learned bar is still there; the state machine confirms it below.
+            dtc->channel_state[c] = LOCKED;
+            dtc->stable_bars_count[c] = dtc->required_stable_bars;
+            dtc->bars_since_lock[c] = 0;
+        }
+    }
+    dtc->unlocked_this_bar &= (uint8_t)~members;
+    dtc->unlocked_last_bar &= (uint8_t)~members;
+    dtc->carried_hits = 0;
+    return shift;
+}
+
+// Run the state machine of the group led by channel `leader` for the bar that just ended.
+// Returns the group's new state; the caller copies it onto every member.
+static FuelInjectorState advanceGroupState(_FuelInjectorAlgorithm* self, int leader, int ppqn, int ticksPerBar) {
+    _FuelInjector_DTC* dtc = self->dtc;
+    const FuelInjectorState endingState = (FuelInjectorState)dtc->channel_state[leader];
+    const int cellTicks = coarseCellTicks(ppqn);
+    const int tolerance = addedParam(self, kAddedParamTolerance);
+
+    // Learning: check whether the last two bars were similar enough to lock. A bar that only
+    // repeats on the 16th grid (swing, a human player) still locks, coarsely.
+    if (endingState == LEARNING) {
+        float minSimilarity = 100.0f;
+        uint8_t coarse = 0;
+        for (int c = leader; c < self->numChannels; ++c) {
+            if (dtc->group_leader[c] != leader) continue;
+            const ChannelPattern& p = channelPattern(self, c);
+            float sim = (tolerance > 0)
+                ? toleranceSimilarity(recordedBar(p, 0), recordedBar(p, 1), ticksPerBar, tolerance)
+                : calculatePatternSimilarity(p);
+            if (sim < SIMILARITY_THRESHOLD && cellTicks > 0) {
+                sim = coarseSimilarity(recordedBar(p, 0), recordedBar(p, 1), ticksPerBar, cellTicks);
+                coarse |= (uint8_t)(1u << c);
+            }
+            if (sim < minSimilarity) minSimilarity = sim;
+        }
+
+        // A bar that does not (yet) lock on its own may repeat a known groove or complete a phrase.
+        if (minSimilarity < SIMILARITY_THRESHOLD) {
+            dtc->stable_bars_count[leader] = 0;
+            return (relockKnownGrooves(self, leader, ppqn, ticksPerBar, cellTicks) ||
+                    lockDetectedPhrase(self, leader)) ? LOCKED : LEARNING;
+        }
+        dtc->stable_bars_count[leader]++;
+        if (dtc->stable_bars_count[leader] < dtc->required_stable_bars) {
+            return (relockKnownGrooves(self, leader, ppqn, ticksPerBar, cellTicks) ||
+                    lockDetectedPhrase(self, leader)) ? LOCKED : LEARNING;
+        }
+        dtc->bars_since_lock[leader] = 0;
+        dtc->phrase_length[leader] = 1;
+        for (int c = leader; c < self->numChannels; ++c) {
+            if (dtc->group_leader[c] != leader) continue;
+            // Snapshot the just-completed bar as the learned pattern.
+            const ChannelPattern& recorded = channelPattern(self, c);
+            loadBar(learnedPattern(self, c), recordedBar(recorded, 0), recordedHitCount(recorded, 0));
+            dtc->variation_ready[c] = 0;
+            if (coarse & (1u << c)) {
+                // Refine the snapshot's timing over the next bars.
+                dtc->coarse_locked |= (uint8_t)(1u << c);
+                beginRefinement(self->refinement[c], recordedBar(recorded, 0), ticksPerBar, cellTicks);
+            } else {
+                dtc->coarse_locked &= (uint8_t)~(1u << c);
+                self->refinement[c].bars_left = 0;
+            }
+        }
+        return LOCKED;
+    }
+
+    // LOCKED/INJECTING: monitor for input pattern changes to trigger re-learning.
+    bool patternChanged = false;
+    for (int c = leader; c < self->numChannels; ++c) {
+        if (dtc->group_leader[c] != leader) continue;
+        patternChanged = lockedPatternChanged(self, c, ticksPerBar, cellTicks);
+        if (patternChanged) {
+            break;
+        }
+    }
+
+    for (int c = leader; c < self->numChannels; ++c) {
+        if (dtc->group_leader[c] != leader) continue;
+        if (endingState == INJECTING) {
+            dtc->trigger_active_steps_remaining[c] = 0;
+        }
+        if (patternChanged) {
+            rememberLearnedGroove(self, c);
+            dtc->variation_ready[c] = 0;
+            dtc->unlocked_this_bar |= (uint8_t)(1u << c);
+        } else if (endingState == INJECTING && addedParam(self, kAddedParamReroll) && dtc->active_variation[c] >= 0) {
+            // Re-roll: retire the variation just played so a fresh one replaces it.
+            dtc->variation_ready[c] &= (uint8_t)~(1u << dtc->active_variation[c]);
+        }
+    }
+
+    if (patternChanged) {
+        dtc->stable_bars_count[leader] = 0;
+        dtc->bars_since_lock[leader] = 0;
+        // A single-bar groove that changes every few bars is a phrase once it has repeated.
+        return lockDetectedPhrase(self, leader) ? LOCKED : LEARNING;
+    }
+
+    if (dtc->phrase_length[leader] > 1) {
+        // A phrase plays its bars as learned; the next one takes over for the bar now starting.
+        for (int c = leader; c < self->numChannels; ++c) {
+            if (dtc->group_leader[c] == leader) loadPhraseBar(self, c);
+        }
+        dtc->bars_since_lock[leader]++;
+        return LOCKED;
+    }
+
+    // Tick-exact and Tolerance locks follow the hit histogram; coarse ones refine instead.
+    for (int c = leader; c < self->numChannels; ++c) {
+        if (dtc->group_leader[c] == leader && !((dtc->coarse_locked & (1u << c)) && cellTicks > 0)) {
+            updateLearnedModel(self, c, ticksPerBar);
+        }
+    }
+
+    for (int c = leader; c < self->numChannels; ++c) {
+        LearnRefinement& refinement = self->refinement[c];
+        if (dtc->group_leader[c] != leader || !(dtc->coarse_locked & (1u << c)) || refinement.bars_left == 0 ||
+            cellTicks == 0) {
+            continue;
+        }
+        ChannelPattern& learned = learnedPattern(self, c);
+        accumulateRefinement(refinement, recordedBar(learned, 0), recordedBar(channelPattern(self, c), 0),
+                             ticksPerBar, cellTicks);
+        if (--refinement.bars_left == 0) {
+            PatternBits refined;
+            const uint16_t hits = applyRefinement(refinement, recordedBar(learned, 0), ticksPerBar, cellTicks, refined);
+            loadBar(learned, refined, hits);
+            dtc->variation_ready[c] = 0;
+        }
+    }
+
+    // Completed one bar while locked/injecting; an injection bar returns to locked.
+    dtc->bars_since_lock[leader]++;
+    return LOCKED;
+}
+
+static void handleBarBoundary(_FuelInjectorAlgorithm* self, int ppqn, int ticksPerBar, int fuel, int injectionInterval) {
+    _FuelInjector_DTC* dtc = self->dtc;
+
+    // The bars recorded out of phase are rotated into place; the next bar starts part way in.
+    const int phase = realignBarPhase(self, ppqn, ticksPerBar);
+    updatePhraseMatches(self, ticksPerBar);
+
+    // Schedule an injection for the *next* bar.
+    // We use (bar_counter + 1) as the next bar number (1-indexed).
+    const bool injectNext = fuel > 0 && shouldInjectThisBar(dtc->bar_counter + 1, injectionInterval);
+    dtc->is_injection_bar = false;
+
+    for (int leader = 0; leader < self->numChannels; ++leader) {
+        if (dtc->group_leader[leader] != leader) {
+            continue;
+        }
+        const bool wasLocked = dtc->channel_state[leader] != LEARNING;
+        FuelInjectorState next = advanceGroupState(self, leader, ppqn, ticksPerBar);
+        // Injection bars only pick pre-rendered variations. A group whose banks have not caught
+        // up (a lock or learned bar that changed at this boundary) plays the bar through.
+        bool inject = next == LOCKED && wasLocked && injectNext;
+        for (int c = leader; c < self->numChannels && inject; ++c) {
+            inject = dtc->group_leader[c] != leader || injectionVariationReady(self, c);
+        }
+        if (inject) {
+            next = INJECTING;
+            dtc->is_injection_bar = true;
+        }
+        for (int c = leader; c < self->numChannels; ++c) {
+            if (dtc->group_leader[c] != leader) continue;
+            dtc->channel_state[c] = (uint8_t)next;
+            dtc->stable_bars_count[c] = dtc->stable_bars_count[leader];
+            dtc->bars_since_lock[c] = dtc->bars_since_lock[leader];
+            dtc->phrase_length[c] = dtc->phrase_length[leader];
+            if (next == INJECTING) {
+                selectInjectionVariation(self, c);
+            }
+        }
+    }
+    dtc->state = summariseChannelStates(dtc->channel_state, self->numChannels);
+
+    // Rotate the recording slots for the next bar (O(1); the reused slot is cleared lazily).
+    for (int c = 0; c < self->numChannels; ++c) {
+        ChannelPattern& p = channelPattern(self, c);
+        if (self->bar_histories != nullptr) {
+            pushHistory(barHistory(self, c), recordedBar(p, 0), recordedHitCount(p, 0));
+        }
+        shiftBarsForNewBar(p);
+    }
+    // Locks and refinements above may have replaced learned bars.
+    refreshLearnedWindows(self, ticksPerBar);
+    dtc->unlocked_last_bar = dtc->unlocked_this_bar;
+    dtc->unlocked_this_bar = 0;
+    // Nothing locks on this grid yet: Auto Grid checks the input's period after the block.
+    dtc->grid_check_due = addedParam(self, kAddedParamAutoGrid) && !dtc->grid_from_reset && dtc->state == LEARNING;
+
+    if (phase > 0) {
+        // The ticks before `phase` of the bar now starting were played at the end of the one
+        // that ended, and were rotated into its start: they belong to this bar too.
+        for (int c = 0; c < self->numChannels; ++c) {
+            ChannelPattern& p = channelPattern(self, c);
+            const PatternBits& previous = recordedBar(p, 1);
+            for (int i = findNextHit(previous, 0, phase); i >= 0; i = findNextHit(previous, i + 1, phase)) {
+                recordHit(p, 0, i, &self->learned_window[c]);
+            }
+            // Tick 0 is skipped, so start the bar's counts here.
+            dtc->missed_hits[c] = 0;
+        }
+        dtc->fast_lock_blocked = 0;
+        dtc->clock_tick_counter = (uint32_t)phase;
+        dtc->current_bar_position = (uint16_t)phase;
+    }
+}
+
+// Trigger length for an event followed by another one `gap` samples later; at most half the
+// gap so the output always returns to 0V in between.
+static inline uint16_t triggerLengthForGap(int baseLength, uint32_t gap) {
+    uint32_t length = (uint32_t)baseLength;
+    if (gap > 0) {
+        uint32_t maxLen = gap / 2;
+        if (maxLen < 1) {
+            maxLen = 1;
+        }
+        if (length > maxLen) {
+            length = maxLen;
+        }
+    }
+    return (uint16_t)length;
+}
+
+static inline void startTrigger(_FuelInjectorAlgorithm* self, int c, uint16_t length, uint8_t level) {
+    self->dtc->trigger_active_steps_remaining[c] = length;
+    self->dtc->trigger_level[c] = TRIGGER_HIGH * level / 255.0f;
+}
+
+// Play the events of `tick` as it starts: on-grid events fire now, off-grid events are
+// queued with a due time predicted from the internal tick period. A bar kept as a grid
+// (see compileEvents) fires its hit, if any.
+static void playTickEvents(_FuelInjectorAlgorithm* self, int c, int tick, int baseTriggerLengthSamples) {
+    _FuelInjector_DTC* dtc = self->dtc;
+    const int slot = dtc->active_variation[c];
+    if (slot < 0) {
+        return;
+    }
+    const EventList& list = variationEvents(self, c, slot);
+    const uint32_t period = internalTickPeriod(dtc->clock);
+    if (list.overflow) {
+        if (list.grid.test(tick)) {
+            startTrigger(self, c, triggerLengthForGap(baseTriggerLengthSamples, period), 255);
+        }
+        return;
+    }
+    const int n = eventsAtTick(list, dtc->play_cursor[c], tick);
+    const HitEvent* ev = &list.events[dtc->play_cursor[c]];
+    dtc->play_cursor[c] = (uint16_t)(dtc->play_cursor[c] + n);
+
+    int fireNow = -1;
+    for (int k = 0; k < n; k++) {
+        const uint32_t due = (uint32_t)(((uint64_t)period * ev[k].offset) / SUBTICKS_PER_TICK);
+        if (due == 0) {
+            fireNow = k;
+        } else if (dtc->pending_count[c] < MAX_PENDING_EVENTS &&
+                   (dtc->pending_count[c] == 0 || dtc->pending_due[c][dtc->pending_count[c] - 1] < due)) {
+            dtc->pending_due[c][dtc->pending_count[c]] = due;
+            dtc->pending_level[c][dtc->pending_count[c]] = ev[k].level;
+            dtc->pending_count[c]++;
+        }
+    }
+    if (fireNow >= 0) {
+        const uint32_t gap = (dtc->pending_count[c] > 0) ? dtc->pending_due[c][0] : period;
+        startTrigger(self, c, triggerLengthForGap(baseTriggerLengthSamples, gap), ev[fireNow].level);
+    }
+}
+
+// Block frame at which `due` (samples after a reference point) falls, given that `elapsed`
+// samples since that point cover everything before `countedFrom`.
+static inline int frameForDue(uint32_t due, uint32_t elapsed, int countedFrom) {
+    if (due == UINT32_MAX) {
+        return INT32_MAX;
+    }
+    return countedFrom - 1 + (int)(due - elapsed);
+}
+
+// Block frame at which channel c's next off-grid event is due, or INT32_MAX.
+static inline int pendingFrame(const _FuelInjectorAlgorithm* self, int c, int countedFrom) {
+    const _FuelInjector_DTC* dtc = self->dtc;
+    if (dtc->pending_count[c] == 0) {
+        return INT32_MAX;
+    }
+    return frameForDue(dtc->pending_due[c][0], dtc->samples_since_tick, countedFrom);
+}
+
+static void firePendingEvents(_FuelInjectorAlgorithm* self, int frame, int countedFrom, int baseTriggerLengthSamples) {
+    _FuelInjector_DTC* dtc = self->dtc;
+    for (int c = 0; c < self->numChannels; ++c) {
+        if (pendingFrame(self, c, countedFrom) > frame) {
+            continue;
+        }
+        const uint32_t due = dtc->pending_due[c][0];
+        const uint8_t level = dtc->pending_level[c][0];
+        dtc->pending_count[c]--;
+        for (int k = 0; k < dtc->pending_count[c]; k++) {
+            dtc->pending_due[c][k] = dtc->pending_due[c][k + 1];
+            dtc->pending_level[c][k] = dtc->pending_level[c][k + 1];
+        }
+        const uint32_t next = (dtc->pending_count[c] > 0) ? dtc->pending_due[c][0] : internalTickPeriod(dtc->clock);
+        startTrigger(self, c, triggerLengthForGap(baseTriggerLengthSamples, (next > due) ? next - due : 0), level);
+    }
+}
+
+// Count the samples up to and including `frame` towards the clock and tick timers.
+static inline void countClockSamples(_FuelInjector_DTC* dtc, int frame, int& countedFrom) {
+    const uint32_t n = (uint32_t)(frame + 1 - countedFrom);
+    dtc->samples_since_clock += n;
+    dtc->samples_since_tick += n;
+    countedFrom = frame + 1;
+}
+
+// Start internal tick `clock_tick_counter`: it becomes the bar position and its events play.
+// Mid-bar change detection: drop a locked group to passthrough as soon as the bar can no
+// longer match its learned pattern, rather than playing the stale groove to the bar end.
+static void checkEarlyPatternChange(_FuelInjectorAlgorithm* self, int c) {
+    _FuelInjector_DTC* dtc = self->dtc;
+    const int leader = dtc->group_leader[c];
+    if (dtc->channel_state[leader] == LEARNING || (dtc->coarse_locked & (1u << c))) {
+        // Coarse locks tolerate timing differences the tick-exact bound would flag.
+        return;
+    }
+    const ChannelPattern& incoming = channelPattern(self, c);
+    if (!patternChangeInevitable(recordedHitCount(learnedPattern(self, c), 0), recordedHitCount(incoming, 0),
+                                 recordedReferenceHits(incoming), dtc->missed_hits[c])) {
+        return;
+    }
+    for (int m = leader; m < self->numChannels; ++m) {
+        if (dtc->group_leader[m] != leader) continue;
+        rememberLearnedGroove(self, m);
+        dtc->channel_state[m] = LEARNING;
+        dtc->stable_bars_count[m] = 0;
+        dtc->bars_since_lock[m] = 0;
+        dtc->trigger_active_steps_remaining[m] = 0;
+        dtc->pending_count[m] = 0;
+        dtc->variation_ready[m] = 0;
+        // This bar already diverged; it is no evidence for a fast lock.
+        dtc->fast_lock_blocked |= (uint8_t)(1u << m);
+        dtc->unlocked_this_bar |= (uint8_t)(1u << m);
+    }
+    dtc->state = summariseChannelStates(dtc->channel_state, self->numChannels);
+}
+
+// Fast lock: on the last comparison Learn Bars asks for, a bar that so far repeats the
+// previous one confidently locks there and then, instead of at the bar end. The completed
+// previous bar becomes the learned pattern.
+static void checkFastLock(_FuelInjectorAlgorithm* self, int c) {
+    _FuelInjector_DTC* dtc = self->dtc;
+    const int leader = dtc->group_leader[c];
+    if (dtc->channel_state[leader] != LEARNING ||
+        dtc->stable_bars_count[leader] + 1 < dtc->required_stable_bars) {
+        return;
+    }
+    bool evidence = false;
+    for (int m = leader; m < self->numChannels; ++m) {
+        if (dtc->group_leader[m] != leader) continue;
+        const ChannelPattern& p = channelPattern(self, m);
+        const int previousHits = recordedHitCount(p, 1);
+        const int currentHits = recordedHitCount(p, 0);
+        if (dtc->fast_lock_blocked & (1u << m)) {
+            return;
+        }
+        if (previousHits == 0 && currentHits == 0) {
+            continue;   // a silent member neither blocks nor confirms
+        }
+        if (!fastLockConfident(previousHits, currentHits, recordedCommonHits(p), dtc->missed_hits[m])) {
+            return;
+        }
+        evidence = true;
+    }
+    if (!evidence) {
+        return;
+    }
+
+    for (int m = leader; m < self->numChannels; ++m) {
+        if (dtc->group_leader[m] != leader) continue;
+        ChannelPattern& p = channelPattern(self, m);
+        loadBar(learnedPattern(self, m), recordedBar(p, 1), recordedHitCount(p, 1));
+        // The learned bar is the previous bar, so the overlap counted so far carries over.
+        p.reference_hits = p.common_hits;
+        dtc->channel_state[m] = LOCKED;
+        dtc->coarse_locked &= (uint8_t)~(1u << m);
+        self->refinement[m].bars_left = 0;
+        dtc->stable_bars_count[m] = dtc->required_stable_bars;
+        dtc->bars_since_lock[m] = 0;
+        dtc->phrase_length[m] = 1;
+        dtc->variation_ready[m] = 0;
+    }
+    refreshLearnedWindows(self, dtc->grid_ticks_per_bar);
+    dtc->state = summariseChannelStates(dtc->channel_state, self->numChannels);
+}
+
+static int beginTick(_FuelInjectorAlgorithm* self, int fuel, bool clockEnabled, int ticksPerBar,
+                     int baseTriggerLengthSamples) {
+    _FuelInjector_DTC* dtc = self->dtc;
+    const int tickPos = static_cast<int>(dtc->clock_tick_counter);
+    dtc->current_bar_position = static_cast<uint16_t>(tickPos);
+    dtc->samples_since_tick = 0;
+    if (dtc->clock.multiplier <= 1 || tickPos % dtc->clock.multiplier == 0) {
+        // First tick of an incoming pulse.
+        onsetAdvance(self->onsets);
+        if (dtc->pulses_since_reset < 0xFFFF) dtc->pulses_since_reset++;
+    }
+
+    // A hit expected `tolerance` ticks before the previous one can no longer arrive in time:
+    // without an incoming hit within the tolerance of it, it counts as missed. Hits closer
+    // to the downbeat than the tolerance could still be matched across the bar end and are
+    // left to the bar-end comparison.
+    const int tolerance = addedParam(self, kAddedParamTolerance);
+    const int due = tickPos - 1 - tolerance;
+    if (tickPos == 0) {
+        dtc->fast_lock_blocked = 0;
+    }
+    for (int c = 0; c < self->numChannels; ++c) {
+        if (tickPos == 0) {
+            dtc->missed_hits[c] = 0;
+            // An early hit of this downbeat that arrived before the bar end.
+            if (dtc->carried_hits & (1u << c)) {
+                recordHit(channelPattern(self, c), 0, 0, &self->learned_window[c]);
+                dtc->carried_hits &= (uint8_t)~(1u << c);
+            }
+            continue;
+        }
+        const ChannelPattern& p = channelPattern(self, c);
+        const PatternBits& expected = (dtc->channel_state[c] == LEARNING) ? recordedBar(p, 1)
+                                                                         : recordedBar(learnedPattern(self, c), 0);
+        if (due >= tolerance && expected.test(due) &&
+            findNextHit(recordedBar(p, 0), due - tolerance, due + tolerance + 1) < 0) {
+            dtc->missed_hits[c]++;
+            checkEarlyPatternChange(self, c);
+        }
+    }
+
+    const uint8_t playback = playbackChannels(self, fuel, clockEnabled);
+    for (int c = 0; c < self->numChannels; ++c) {
+        // Off-grid events still pending from the previous tick are late; drop them.
+        dtc->pending_count[c] = 0;
+        if ((playback & (1u << c)) && tickPos >= 0 && tickPos < ticksPerBar) {
+            playTickEvents(self, c, tickPos, baseTriggerLengthSamples);
+        }
+    }
+    return tickPos;
+}
+
+// Finish the current tick: advance the counter and handle end-of-bar transitions.
+static void endTick(_FuelInjectorAlgorithm* self, int ppqn, int ticksPerBar, int fuel, int injectionInterval) {
+    _FuelInjector_DTC* dtc = self->dtc;
+    dtc->clock_tick_counter++;
+    if (dtc->clock_tick_counter >= (uint32_t)ticksPerBar) {
+        dtc->clock_tick_counter = 0;
+        dtc->bar_counter++;
+        dtc->current_bar_position = 0;
+        handleBarBoundary(self, ppqn, ticksPerBar, fuel, injectionInterval);
+    }
+}
+
+// A reset while the clock is stopped is the transport restarting from the top: realign to
+// bar 1 but keep the learned patterns and the lock. The half-recorded bar is discarded.
+static void restartFromBarStart(_FuelInjectorAlgorithm* self) {
+    _FuelInjector_DTC* dtc = self->dtc;
+    dtc->bar_counter = 0;
+    dtc->current_bar_position = 0;
+    dtc->clock_tick_counter = 0;
+    dtc->current_bar_index = 0;
+    dtc->is_injection_bar = false;
+    dtc->pulses_since_reset = 0;
+    dtc->reset_span = 0;   // the span before the stop is no bar
+    clockTrackerRestart(dtc->clock);
+
+    for (int c = 0; c < self->numChannels; ++c) {
+        if (dtc->channel_state[c] == INJECTING) {
+            dtc->channel_state[c] = LOCKED;
+        }
+        ChannelPattern& p = channelPattern(self, c);
+        p.stale_slots |= (uint8_t)(1 << p.current_slot);
+        dtc->trigger_active_steps_remaining[c] = 0;
+        dtc->pending_count[c] = 0;
+        // Phrases restart with the bar count; the bars before the restart no longer lead up
+        // to this one.
+        if (self->bar_histories != nullptr) {
+            barHistory(self, c).count = 0;
+        }
+        if (dtc->channel_state[c] != LEARNING) {
+            loadPhraseBar(self, c);
+        }
+    }
+    refreshLearnedWindows(self, dtc->grid_ticks_per_bar);
+    dtc->state = summariseChannelStates(dtc->channel_state, self->numChannels);
+}
+
+static void readGroupLeaders(const _FuelInjectorAlgorithm* self, uint8_t* leaders) {
+    uint8_t groups[MAX_CHANNELS];
+    for (int c = 0; c < self->numChannels; ++c) {
+        groups[c] = (uint8_t)self->v[groupParamIndex(self->numChannels, c)];
+    }
+    resolveGroupLeaders(groups, self->numChannels, leaders);
+}
+
+// Follow the per-channel Group parameters. A channel that changes group relearns together
+// with the group it joins.
+static void updateChannelGroups(_FuelInjectorAlgorithm* self) {
+    _FuelInjector_DTC* dtc = self->dtc;
+    uint8_t leaders[MAX_CHANNELS];
+    readGroupLeaders(self, leaders);
+
+    bool changed = false;
+    for (int c = 0; c < self->numChannels; ++c) {
+        if (leaders[c] == dtc->group_leader[c]) {
+            continue;
+        }
+        changed = true;
+        dtc->group_leader[c] = leaders[c];
+        dtc->channel_state[leaders[c]] = LEARNING;
+        dtc->stable_bars_count[leaders[c]] = 0;
+    }
+    if (!changed) {
+        return;
+    }
+    for (int c = 0; c < self->numChannels; ++c) {
+        const int leader = dtc->group_leader[c];
+        if (dtc->channel_state[leader] == LEARNING && dtc->channel_state[c] != LEARNING) {
+            dtc->trigger_active_steps_remaining[c] = 0;
+            dtc->variation_ready[c] = 0;
+        }
+        dtc->channel_state[c] = dtc->channel_state[leader];
+        dtc->stable_bars_count[c] = dtc->stable_bars_count[leader];
+    }
+    dtc->state = summariseChannelStates(dtc->channel_state, self->numChannels);
+}
+
+// Main audio processing callback
+static void fuel_injector_step(_NT_algorithm* self_base, float* busFrames, int numFramesBy4) {
+    _FuelInjectorAlgorithm* self = static_cast<_FuelInjectorAlgorithm*>(self_base);
+    
+    int numFrames = numFramesBy4 * 4;
+    int clockBus = self->v[kParamClockInput] - 1;
+    int resetBus = self->v[kParamResetInput] - 1;
+    const TickGrid grid = resolveTickGrid(self);
+    const int multiplier = grid.multiplier;
+    if (self->dtc->clock.multiplier != multiplier) {
+        self->dtc->clock.multiplier = (uint8_t)multiplier;
+        self->dtc->clock.ticks_emitted = (uint8_t)multiplier;
+    }
+    int ppqn = grid.ppqn;
+    int ticksPerBar = grid.ticksPerBar;
+    self->dtc->grid_ppqn = (uint16_t)ppqn;
+    self->dtc->grid_ticks_per_bar = (uint16_t)ticksPerBar;
+    int fuel = self->v[kParamFuel];
+    int injectionInterval = self->v[kParamInjectionInterval];
+    int learningBars = self->v[kParamLearningBars];
+    
+    // Output pulses in LOCKED/INJECTING are treated as triggers (~10ms max).
+    // Passthrough (LEARNING) preserves incoming gate length by copying the input signal.
+    int baseTriggerLengthSamples = (int)((10.0f / 1000.0f) * NT_globals.sampleRate);
+    if (baseTriggerLengthSamples < 1) {
+        baseTriggerLengthSamples = 1;
+    }
+    
+    // learningBars is the number of bars to observe; stability is checked across consecutive bar pairs.
+    // e.g. learningBars=2 -> require 1 stable comparison (2 bars total).
+    self->dtc->required_stable_bars = (learningBars > 1) ? (learningBars - 1) : 1;
+
+    const bool clockEnabled = (self->v[kParamClockSource] == 0) && (clockBus >= 0);
+    const float* clockIn = clockEnabled ? busFrames + clockBus * numFrames : nullptr;
+    const float* resetIn = (resetBus >= 0) ? busFrames + resetBus * numFrames : nullptr;
+
+    ChannelRoute routes[MAX_CHANNELS];
+    buildChannelRoutes(self, busFrames, numFrames, routes);
+    updateChannelGroups(self);
+    
+    // Process the block in chunks small enough for the on-stack edge masks.
+    for (int chunkStart = 0; chunkStart < numFrames; chunkStart += MAX_SCAN_FRAMES) {
+        int chunkFrames = numFrames - chunkStart;
+        if (chunkFrames > MAX_SCAN_FRAMES) {
+            chunkFrames = MAX_SCAN_FRAMES;
+        }
+
+        // Scan every input bus once for rising edges.
+        uint16_t edgeMasks[MAX_SCAN_FRAMES];
+        memset(edgeMasks, 0, chunkFrames * sizeof(uint16_t));
+        int edgeCount = 0;
+
+        if (clockEnabled) {
+            edgeCount += scanRisingEdges(clockIn + chunkStart, chunkFrames,
+                                         self->dtc->prev_clock_value, TRIGGER_THRESHOLD,
+                                         edgeMasks, FRAME_EVENT_CLOCK);
+        } else {
+            self->dtc->prev_clock_value = 0.0f;
+            self->dtc->samples_since_clock = 0;
+            self->dtc->samples_since_tick = 0;
+            self->dtc->last_clock_period_samples = 0;
+            resetClockTracker(self->dtc->clock, multiplier);
+        }
+        if (resetIn) {
+            edgeCount += scanRisingEdges(resetIn + chunkStart, chunkFrames,
+                                         self->dtc->prev_reset_value, TRIGGER_THRESHOLD,
+                                         edgeMasks, FRAME_EVENT_RESET);
+        } else {
+            self->dtc->prev_reset_value = 0.0f;
+        }
+        for (int c = 0; c < self->numChannels; ++c) {
+            if (routes[c].in) {
+                edgeCount += scanRisingEdges(routes[c].in + chunkStart, chunkFrames,
+                                             self->dtc->prev_trigger_value[c], TRIGGER_THRESHOLD,
+                                             edgeMasks, (uint16_t)(1 << c));
+            } else {
+                self->dtc->prev_trigger_value[c] = 0.0f;
+            }
+        }
+
+        FrameEvent events[MAX_SCAN_FRAMES];
+        int numEvents = (edgeCount > 0) ? buildFrameEvents(edgeMasks, chunkFrames, events) : 0;
+
+        // Run the state machine on event frames only; frames in between are rendered in bulk.
+        int renderFrom = 0;
+        int countedFrom = 0;
+        for (int e = 0; e <= numEvents; e++) {
+            const int frame = (e < numEvents) ? events[e].frame : chunkFrames;
+
+            uint8_t playback = playbackChannels(self, fuel, clockEnabled);
+
+            // Internal ticks and off-grid events due before this frame split the bulk render.
+            while (clockEnabled) {
+                const int tickFrame = frameForDue(nextInternalTickDue(self->dtc->clock),
+                                                  self->dtc->samples_since_clock, countedFrom);
+                int due = tickFrame;
+                for (int c = 0; c < self->numChannels; ++c) {
+                    if (playback & (1u << c)) {
+                        const int f = pendingFrame(self, c, countedFrom);
+                        if (f < due) due = f;
+                    }
+                }
+                if (due < renderFrom) {
+                    due = renderFrom;
+                }
+                if (due >= frame) {
+                    break;
+                }
+                for (int c = 0; c < self->numChannels; ++c) {
+                    renderChannel(routes[c], self->dtc->trigger_active_steps_remaining[c], self->dtc->trigger_level[c],
+                                  chunkStart + renderFrom, chunkStart + due, (playback >> c) & 1);
+                }
+                if (due < tickFrame) {
+                    firePendingEvents(self, due, countedFrom, baseTriggerLengthSamples);
+                    renderFrom = due;
+                    continue;
+                }
+
+                // A synthesised internal tick: no input edges fall on this frame.
+                countClockSamples(self->dtc, due, countedFrom);
+                clockTrackerAdvance(self->dtc->clock, self->dtc->samples_since_clock);
+                beginTick(self, fuel, clockEnabled, ticksPerBar, baseTriggerLengthSamples);
+                playback = playbackChannels(self, fuel, clockEnabled);
+                for (int c = 0; c < self->numChannels; ++c) {
+                    renderChannel(routes[c], self->dtc->trigger_active_steps_remaining[c], self->dtc->trigger_level[c],
+                                  chunkStart + due, chunkStart + due + 1, (playback >> c) & 1);
+                }
+                renderFrom = due + 1;
+                endTick(self, ppqn, ticksPerBar, fuel, injectionInterval);
+                playback = playbackChannels(self, fuel, clockEnabled);
+            }
+
+            for (int c = 0; c < self->numChannels; ++c) {
+                renderChannel(routes[c], self->dtc->trigger_active_steps_remaining[c], self->dtc->trigger_level[c],
+                              chunkStart + renderFrom, chunkStart + frame, (playback >> c) & 1);
+            }
+            if (e == numEvents) {
+                break;
+            }
+
+            const uint16_t mask = events[e].mask;
+            const bool clockEdge = (mask & FRAME_EVENT_CLOCK) != 0;
+
+            if (clockEnabled) {
+                countClockSamples(self->dtc, frame, countedFrom);
+            }
+
+            if ((mask & FRAME_EVENT_RESET) && self->dtc->clock.stopped) {
+                restartFromBarStart(self);
+            } else if (mask & FRAME_EVENT_RESET) {
+                self->dtc->state = LEARNING;
+                self->dtc->bar_counter = 0;
+                self->dtc->current_bar_position = 0;
+                self->dtc->clock_tick_counter = 0;
+                self->dtc->current_bar_index = 0;
+                self->dtc->is_injection_bar = false;
+                // The next real clock edge is tick 0; drop the rest of the current pulse.
+                self->dtc->clock.ticks_emitted = self->dtc->clock.multiplier;
+                invalidateVariations(self);
+                // O(1) however many channels: patterns are emptied lazily on next use.
+                self->dtc->pattern_epoch++;
+
+                for (int c = 0; c < self->numChannels; ++c) {
+                    self->dtc->channel_state[c] = LEARNING;
+                    self->dtc->stable_bars_count[c] = 0;
+                    self->dtc->bars_since_lock[c] = 0;
+                    self->dtc->trigger_active_steps_remaining[c] = 0;
+                    self->dtc->pending_count[c] = 0;
+                }
+
+                // Auto Grid: resets the same number of clock pulses apart twice running mark
+                // out whole bars.
+                const uint16_t span = self->dtc->pulses_since_reset;
+                if (addedParam(self, kAddedParamAutoGrid) && span > 0 && span == self->dtc->reset_span) {
+                    self->dtc->grid_from_reset = true;
+                    if (inferTickGrid(self, 1, span)) {
+                        ppqn = self->dtc->grid_ppqn;
+                        ticksPerBar = self->dtc->grid_ticks_per_bar;
+                    }
+                }
+                self->dtc->reset_span = span;
+                self->dtc->pulses_since_reset = 0;
+            }
+
+            // Internal ticks starting on this frame: on a clock edge any owed by an early edge
+            // plus the edge's own, otherwise a synthesised tick that falls due here.
+            int ticks = 0;
+            if (clockEdge) {
+                const uint32_t elapsed = self->dtc->samples_since_clock;
+                ticks = clockTrackerEdge(self->dtc->clock, self->dtc->samples_since_clock);
+                if (ticks > 0) {
+                    self->dtc->last_clock_period_samples = elapsed;
+                }
+            } else if (clockEnabled && nextInternalTickDue(self->dtc->clock) <= self->dtc->samples_since_clock) {
+                clockTrackerAdvance(self->dtc->clock, self->dtc->samples_since_clock);
+                ticks = 1;
+            }
+
+            int tickPos = static_cast<int>(self->dtc->current_bar_position);
+            for (int t = 0; t < ticks; t++) {
+                if (t > 0) {
+                    endTick(self, ppqn, ticksPerBar, fuel, injectionInterval);
+                }
+                tickPos = beginTick(self, fuel, clockEnabled, ticksPerBar, baseTriggerLengthSamples);
+            }
+
+            const uint8_t eventPlayback = playbackChannels(self, fuel, clockEnabled);
+
+            if ((mask & ((1u << self->numChannels) - 1)) && addedParam(self, kAddedParamAutoGrid) && !self->dtc->clock.stopped) {
+                // Hits past the middle of a pulse count for the next one.
+                const uint32_t period = internalTickPeriod(self->dtc->clock);
+                const uint32_t into = (uint32_t)(tickPos % self->dtc->clock.multiplier) * period +
+                                      self->dtc->samples_since_tick;
+                onsetRecord(self->onsets, period > 0 && 2 * into >= self->dtc->clock.multiplier * period);
+            }
+
+            for (int c = 0; c < self->numChannels; ++c) {
+                // Record hits relative to the most recent clock tick; do not require the trigger
+                // to coincide sample-exactly with the clock edge.
+                if ((mask & (1 << c)) && !self->dtc->clock.stopped) {
+                    if (tickPos >= 0 && tickPos < ticksPerBar) {
+                        ChannelPattern& p = channelPattern(self, c);
+                        const PatternBits& expected = (self->dtc->channel_state[c] == LEARNING)
+                            ? recordedBar(p, 1) : recordedBar(learnedPattern(self, c), 0);
+                        if (carriesToNextBar(expected, tickPos, ticksPerBar, addedParam(self, kAddedParamTolerance))) {
+                            // Recorded on the next downbeat (see beginTick).
+                            self->dtc->carried_hits |= (uint8_t)(1u << c);
+                        } else {
+                            // Compared against the learned bar as it arrives (see detectPatternChange);
+                            // a hit within the Tolerance of a learned hit counts as expected.
+                            recordHit(p, 0, tickPos, &self->learned_window[c]);
+                            checkEarlyPatternChange(self, c);
+                            checkFastLock(self, c);
+                        }
+                    }
+                }
+
+                renderChannel(routes[c], self->dtc->trigger_active_steps_remaining[c], self->dtc->trigger_level[c],
+                              chunkStart + frame, chunkStart + frame + 1, (eventPlayback >> c) & 1);
+            }
+            renderFrom = frame + 1;
+
+            if (ticks > 0) {
+                endTick(self, ppqn, ticksPerBar, fuel, injectionInterval);
+            }
+        }
+
+        if (clockEnabled) {
+            self->dtc->samples_since_clock += (uint32_t)(chunkFrames - countedFrom);
+            self->dtc->samples_since_tick += (uint32_t)(chunkFrames - countedFrom);
+            if (!self->dtc->clock.stopped && isClockStopped(self->dtc->clock, self->dtc->samples_since_clock)) {
+                // Transport stopped: freeze where we are until the next edge.
+                self->dtc->clock.stopped = true;
+                for (int c = 0; c < self->numChannels; ++c) {
+                    self->dtc->pending_count[c] = 0;
+                }
+            }
+        }
+    }
+
+    if (self->dtc->grid_check_due) {
+        self->dtc->grid_check_due = false;
+        inferGridFromHits(self);
+        ppqn = self->dtc->grid_ppqn;
+        ticksPerBar = self->dtc->grid_ticks_per_bar;
+    }
+
+    fillVariationBank(self, ppqn, ticksPerBar, fuel);
+}
+
+// Custom UI check
+static uint32_t fuel_injector_has_custom_ui(_NT_algorithm* self_base) {
+    // Return 0 for now (no custom UI overrides)
+    // Could return kNT_potButtonL | kNT_potButtonC | kNT_potButtonR to override pots
+    return 0;
+}
+
+// Setup UI pots
+static void fuel_injector_setup_ui(_NT_algorithm* self_base, _NT_float3& pots) {
+    _FuelInjectorAlgorithm* self = static_cast<_FuelInjectorAlgorithm*>(self_base);
+    
+    // Map pot to Fuel parameter (0-100 -> 0.0-1.0)
+    pots[0] = self->v[kParamFuel] / 100.0f;
+    pots[1] = 0.0f;
+    pots[2] = 0.0f;
+}
+
+// Custom UI handling
+static void fuel_injector_custom_ui(_NT_algorithm* self_base, const _NT_uiData& data) {
+    _FuelInjectorAlgorithm* self = static_cast<_FuelInjectorAlgorithm*>(self_base);
+    (void)self;
+    (void)data;
+}
+
+// Draw custom display
+static bool fuel_injector_draw(_NT_algorithm* self_base) {
+    _FuelInjectorAlgorithm* self = static_cast<_FuelInjectorAlgorithm*>(self_base);
+    if (!self || !self->dtc) {
+        return false;
+    }
+
+    const _FuelInjector_DTC* dtc = self->dtc;
+
+    const char* stateStr = "LEARN";
+    switch (dtc->state) {
+        case LEARNING: stateStr = "LEARN"; break;
+        case LOCKED: stateStr = "LOCK"; break;
+        case INJECTING: stateStr = "INJ"; break;
+    }
+    if (dtc->clock.stopped) {
+        stateStr = "STOP";
+    }
+
+    // Leave room for the host's parameter line (top of screen).
+    NT_drawText(2, 20, "Fuel Injector", 15, kNT_textLeft, kNT_textTiny);
+
+    char numBuf[12] = {0};
+    char lineBuf[32] = {0};
+
+    // State
+    NT_drawText(2, 28, stateStr, 15, kNT_textLeft, kNT_textTiny);
+
+    // Bar
+    int nlen = NT_intToString(numBuf, (int32_t)dtc->bar_counter);
+    int pos = 0;
+    const char* prefix = "Bar:";
+    while (prefix[pos] && pos < (int)sizeof(lineBuf) - 1) {
+        lineBuf[pos] = prefix[pos];
+        pos++;
+    }
+    for (int i = 0; i < nlen && pos < (int)sizeof(lineBuf) - 1; i++) {
+        lineBuf[pos++] = numBuf[i];
+    }
+    lineBuf[pos] = '\0';
+    NT_drawText(48, 28, lineBuf, 15, kNT_textLeft, kNT_textTiny);
+
+    // Tick
     memset(lineBuf, 0, sizeof(lineBuf));
     nlen = NT_intToString(numBuf, (int32_t)dtc->current_bar_position);
     pos = 0;
@@ -827,10 +2117,12 @@ static bool fuel_injector_draw(_NT_algorithm* self_base) {
     lineBuf[pos] = '\0';
     NT_drawText(120, 28, lineBuf, 15, kNT_textLeft, kNT_textTiny);
 
-    // Learned hit count for channel 1 (if available).
+    // Learned hit count for channel 1 (if available). Read-only here: a pattern from an
+    // older epoch counts as empty.
     if (self->learned_patterns != nullptr) {
+        const ChannelPattern& learned = self->learned_patterns[0];
         memset(lineBuf, 0, sizeof(lineBuf));
-        nlen = NT_intToString(numBuf, (int32_t)self->learned_patterns[0].hit_count_bar1);
+        nlen = NT_intToString(numBuf, (learned.epoch == dtc->pattern_epoch) ? (int32_t)recordedHitCount(learned, 0) : 0);
         pos = 0;
         prefix = "Ch1Hits:";
         while (prefix[pos] && pos < (int)sizeof(lineBuf) - 1) {
@@ -878,7 +2170,249 @@ static bool fuel_injector_draw(_NT_algorithm* self_base) {
     return false;
 }
 
+static void addSavedBar(_NT_jsonStream& stream, const PatternBits& bar, int ticksPerBar) {
+    uint16_t deltas[MAX_TICKS_PER_BAR];
+    const int count = encodeHitDeltas(bar, ticksPerBar, deltas);
+    stream.openArray();
+    for (int i = 0; i < count; ++i) {
+        stream.addNumber((int)deltas[i]);
+    }
+    stream.closeArray();
+}
+
+// Presets carry the learned groove so a recalled preset starts locked instead of learning.
+// Hits are saved delta-coded on the grid they were learned on; a locked phrase also saves
+// each of its bars.
+static void fuel_injector_serialise(_NT_algorithm* self_base, _NT_jsonStream& stream) {
+    _FuelInjectorAlgorithm* self = static_cast<_FuelInjectorAlgorithm*>(self_base);
+    const _FuelInjector_DTC* dtc = self->dtc;
+
+    stream.addMemberName("ppqn");
+    stream.addNumber((int)dtc->grid_ppqn);
+    stream.addMemberName("ticksPerBar");
+    stream.addNumber((int)dtc->grid_ticks_per_bar);
+    stream.addMemberName("seed");
+    stream.addNumber((int)dtc->prng.state);
+
+    stream.addMemberName("channels");
+    stream.openArray();
+    for (int c = 0; c < self->numChannels; ++c) {
+        const ChannelPattern& learned = self->learned_patterns[c];
+        const bool locked = dtc->grid_ppqn != 0 && dtc->channel_state[c] != LEARNING &&
+                            learned.epoch == dtc->pattern_epoch;
+        stream.openObject();
+        stream.addMemberName("locked");
+        stream.addBoolean(locked);
+        stream.addMemberName("coarse");
+        stream.addBoolean(locked && (dtc->coarse_locked & (1u << c)));
+        stream.addMemberName("hits");
+        if (locked) {
+            addSavedBar(stream, recordedBar(learned, 0), dtc->grid_ticks_per_bar);
+        } else {
+            stream.openArray();
+            stream.closeArray();
+        }
+        const int phraseLength = dtc->phrase_length[dtc->group_leader[c]];
+        if (locked && phraseLength > 1 && self->phrases != nullptr) {
+            stream.addMemberName("phrase");
+            stream.openArray();
+            for (int k = 0; k < phraseLength; ++k) {
+                addSavedBar(stream, self->phrases[c].bars[k], dtc->grid_ticks_per_bar);
+            }
+            stream.closeArray();
+        }
+        stream.closeObject();
+    }
+    stream.closeArray();
+}
+
+static bool parseSavedBar(_NT_jsonParse& parse, PatternBits& bar, uint16_t& hitCount) {
+    int numHits;
+    if (!parse.numberOfArrayElements(numHits) || numHits > MAX_TICKS_PER_BAR) {
+        return false;
+    }
+    uint16_t deltas[MAX_TICKS_PER_BAR];
+    for (int i = 0; i < numHits; ++i) {
+        int delta;
+        if (!parse.number(delta) || delta < 0 || delta >= MAX_TICKS_PER_BAR) {
+            return false;
+        }
+        deltas[i] = (uint16_t)delta;
+    }
+    return decodeHitDeltas(deltas, numHits, MAX_TICKS_PER_BAR, bar, hitCount);
+}
+
+// One saved channel. `phraseLength` is 1 unless the channel was saved locked to a phrase,
+// whose bars then go to `phrase`.
+static bool parseSavedChannel(_NT_jsonParse& parse, bool& locked, bool& coarse, PatternBits& bar,
+                              uint16_t& hitCount, LearnedPhrase& phrase, int& phraseLength) {
+    locked = false;
+    coarse = false;
+    bar.clear();
+    hitCount = 0;
+    phraseLength = 1;
+    int numMembers;
+    if (!parse.numberOfObjectMembers(numMembers)) {
+        return false;
+    }
+    for (int m = 0; m < numMembers; ++m) {
+        if (parse.matchName("locked")) {
+            if (!parse.boolean(locked)) {
+                return false;
+            }
+        } else if (parse.matchName("coarse")) {
+            if (!parse.boolean(coarse)) {
+                return false;
+            }
+        } else if (parse.matchName("hits")) {
+            if (!parseSavedBar(parse, bar, hitCount)) {
+                return false;
+            }
+        } else if (parse.matchName("phrase")) {
+            if (!parse.numberOfArrayElements(phraseLength) || phraseLength < 1 || phraseLength > MAX_PHRASE_BARS) {
+                return false;
+            }
+            for (int k = 0; k < phraseLength; ++k) {
+                if (!parseSavedBar(parse, phrase.bars[k], phrase.hit_counts[k])) {
+                    return false;
+                }
+            }
+        } else if (!parse.skipMember()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool fuel_injector_deserialise(_NT_algorithm* self_base, _NT_jsonParse& parse) {
+    _FuelInjectorAlgorithm* self = static_cast<_FuelInjectorAlgorithm*>(self_base);
+    _FuelInjector_DTC* dtc = self->dtc;
+
+    int savedPpqn = 0;
+    int savedTicksPerBar = 0;
+    bool locked[MAX_CHANNELS] = {};
+    uint8_t coarse = 0;
+    PatternBits bars[MAX_CHANNELS];
+    uint16_t hitCounts[MAX_CHANNELS];
+    LearnedPhrase phrases[MAX_CHANNELS];
+    int phraseLengths[MAX_CHANNELS];
+    for (int c = 0; c < MAX_CHANNELS; ++c) {
+        phraseLengths[c] = 1;
+    }
+
+    int numMembers;
+    if (!parse.numberOfObjectMembers(numMembers)) {
+        return false;
+    }
+    for (int m = 0; m < numMembers; ++m) {
+        if (parse.matchName("ppqn")) {
+            if (!parse.number(savedPpqn)) {
+                return false;
+            }
+        } else if (parse.matchName("ticksPerBar")) {
+            if (!parse.number(savedTicksPerBar)) {
+                return false;
+            }
+        } else if (parse.matchName("seed")) {
+            int seed;
+            if (!parse.number(seed)) {
+                return false;
+            }
+            if (seed != 0) {
+                dtc->prng.state = (uint32_t)seed;
+            }
+        } else if (parse.matchName("channels")) {
+            int numSaved;
+            if (!parse.numberOfArrayElements(numSaved)) {
+                return false;
+            }
+            for (int c = 0; c < numSaved; ++c) {
+                // Channels beyond the current channel count are parsed and dropped.
+                bool savedLocked;
+                bool savedCoarse;
+                PatternBits bar;
+                uint16_t hitCount;
+                int phraseLength;
+                LearnedPhrase dropped;
+                LearnedPhrase& phrase = (c < self->numChannels) ? phrases[c] : dropped;
+                if (!parseSavedChannel(parse, savedLocked, savedCoarse, bar, hitCount, phrase, phraseLength)) {
+                    return false;
+                }
+                if (c < self->numChannels) {
+                    locked[c] = savedLocked;
+                    if (savedCoarse) {
+                        coarse |= (uint8_t)(1u << c);
+                    }
+                    bars[c] = bar;
+                    hitCounts[c] = hitCount;
+                    phraseLengths[c] = phraseLength;
+                }
+            }
+        } else if (!parse.skipMember()) {
+            return false;
+        }
+    }
+
+    if (savedPpqn <= 0 || savedTicksPerBar <= 0 || savedTicksPerBar > MAX_TICKS_PER_BAR ||
+        savedTicksPerBar % savedPpqn != 0) {
+        return true;
+    }
 
+    // A group is restored locked only when every member was saved locked, on the same phrase
+    // length. Without the phrase's bars (or a place to keep them) it learns again.
+    readGroupLeaders(self, dtc->group_leader);
+    uint8_t unlockedLeaders = 0;
+    for (int c = 0; c < self->numChannels; ++c) {
+        const int leader = dtc->group_leader[c];
+        bool valid = locked[c] && findNextHit(bars[c], savedTicksPerBar, MAX_TICKS_PER_BAR) < 0 &&
+                     phraseLengths[c] == phraseLengths[leader] && (phraseLengths[c] == 1 || self->phrases != nullptr);
+        for (int k = 0; k < phraseLengths[c] && valid && phraseLengths[c] > 1; ++k) {
+            valid = findNextHit(phrases[c].bars[k], savedTicksPerBar, MAX_TICKS_PER_BAR) < 0;
+        }
+        if (!valid) {
+            unlockedLeaders |= (uint8_t)(1u << leader);
+        }
+    }
+
+    dtc->pattern_epoch++;
+    dtc->coarse_locked = coarse;
+    dtc->grid_ppqn = (uint16_t)savedPpqn;
+    dtc->grid_ticks_per_bar = (uint16_t)savedTicksPerBar;
+    for (int c = 0; c < self->numChannels; ++c) {
+        dtc->stable_bars_count[c] = 0;
+        dtc->bars_since_lock[c] = 0;
+        dtc->phrase_length[c] = 1;
+        self->refinement[c].bars_left = 0;
+        if (unlockedLeaders & (1u << dtc->group_leader[c])) {
+            dtc->channel_state[c] = LEARNING;
+        } else {
+            dtc->channel_state[c] = LOCKED;
+            loadBar(learnedPattern(self, c), bars[c], hitCounts[c]);
+            if (phraseLengths[c] > 1) {
+                dtc->phrase_length[c] = (uint8_t)phraseLengths[c];
+                self->phrases[c] = phrases[c];
+            }
+        }
+    }
+    invalidateVariations(self);
+
+    // Parameters may describe a different grid than the one the groove was saved on.
+    const TickGrid grid = resolveTickGrid(self);
+    if (grid.ppqn != savedPpqn || grid.ticksPerBar != savedTicksPerBar) {
+        resampleLearnedPatterns(self, grid);
+        dtc->grid_ppqn = (uint16_t)grid.ppqn;
+        dtc->grid_ticks_per_bar = (uint16_t)grid.ticksPerBar;
+    }
+    // A phrase picks up at the bar the bar count is on.
+    for (int c = 0; c < self->numChannels; ++c) {
+        if (dtc->channel_state[c] != LEARNING) {
+            loadPhraseBar(self, c);
+        }
+    }
+    refreshLearnedWindows(self, dtc->grid_ticks_per_bar);
+    dtc->state = summariseChannelStates(dtc->channel_state, self->numChannels);
+    return true;
+}
 
 // Factory definition
 static const _NT_factory s_fuel_injector_factory = {
@@ -900,8 +2434,8 @@ static const _NT_factory s_fuel_injector_factory = {
     .hasCustomUi = fuel_injector_has_custom_ui,
     .customUi = fuel_injector_custom_ui,
     .setupUi = fuel_injector_setup_ui,
-    .serialise = NULL,
-    .deserialise = NULL,
+    .serialise = fuel_injector_serialise,
+    .deserialise = fuel_injector_deserialise,
     .midiSysEx = NULL,
     .parameterUiPrefix = NULL,
     .parameterString = NULL
@@ -10,6 +10,8 @@
 constexpr int MAX_CHANNELS = 8;
 constexpr int MAX_PPQN = 48;
 constexpr int MAX_TICKS_PER_BAR = 336;
+constexpr int MAX_BAR_QUARTERS = 8;   // longest Bar Length setting
+constexpr int VARIATION_BANK_SIZE = 4;  // pre-rendered injection variations per channel
 
 enum FuelInjectorState {
     LEARNING,
@@ -43,13 +45,179 @@ struct XorShift32 {
     }
 };
 
+constexpr int PATTERN_WORDS = (MAX_TICKS_PER_BAR + 31) / 32;
+
+// One bit per clock tick of a bar (336 ticks in 11 words).
+struct PatternBits {
+    uint32_t words[PATTERN_WORDS];
+
+    bool test(int tick) const {
+        return (words[tick >> 5] >> (tick & 31)) & 1u;
+    }
+
+    void set(int tick) {
+        words[tick >> 5] |= 1u << (tick & 31);
+    }
+
+    void reset(int tick) {
+        words[tick >> 5] &= ~(1u << (tick & 31));
+    }
+
+    void clear() {
+        for (int i = 0; i < PATTERN_WORDS; i++) {
+            words[i] = 0;
+        }
+    }
+};
+
+constexpr int MAX_BAR_EVENTS = 48;        // events of a typical bar; denser bars play from the grid
+constexpr int MAX_OFF_GRID_HITS = 64;
+constexpr int MAX_PENDING_EVENTS = 8;
+constexpr int SUBTICKS_PER_TICK = 256;
+
+// One output trigger. `offset` delays it past its grid tick in 1/256 of a tick;
+// `level` scales the trigger voltage (255 = full).
+struct HitEvent {
+    uint16_t tick;
+    uint8_t offset;
+    uint8_t level;
+};
+
+// A bar's output triggers sorted by (tick, offset). A bar with more than MAX_BAR_EVENTS
+// triggers is kept as `grid` instead (`overflow`), its off-grid hits rounded down onto it.
+struct EventList {
+    uint16_t count;
+    bool overflow;
+    HitEvent events[MAX_BAR_EVENTS];
+    PatternBits grid;
+};
+
+// Generated hits that fall between clock ticks, as tick * SUBTICKS_PER_TICK + offset.
+struct OffGridHits {
+    uint8_t count;
+    uint32_t positions[MAX_OFF_GRID_HITS];
+};
+
+// Two recording slots used ping-pong: `current_slot` is the bar being recorded and the
+// other slot holds the previous bar. Rotating flips the index and marks the reused slot
+// stale; stale slots read as empty and are cleared when next written.
 struct ChannelPattern {
-    uint16_t hit_positions_bar1[MAX_TICKS_PER_BAR];
-    uint16_t hit_positions_bar2[MAX_TICKS_PER_BAR];
-    uint16_t hit_count_bar1;
-    uint16_t hit_count_bar2;
+    PatternBits bars[2];
+    uint16_t hit_counts[2];
+    uint16_t common_hits;    // hits present in both recorded bars, kept by recordHit
+    uint16_t reference_hits; // current-bar hits also in the reference (learned) bar
+    uint8_t current_slot;
+    uint8_t stale_slots;
     uint8_t timing_variance[MAX_TICKS_PER_BAR / 8];
     bool has_stable_pattern;
+    uint32_t epoch;          // pattern epoch this content belongs to; older content is empty
+};
+
+constexpr int MAX_COARSE_CELLS = 32;  // 16ths in the longest bar (8 quarter notes)
+constexpr int REFINE_BARS = 3;        // bars after a coarse lock used to refine the timing
+
+// Timing refinement after a lock on the 16th grid: per 16th holding a learned hit, the summed
+// offset of the hits played there since the lock. `samples` counts the learned bar itself;
+// 0 marks a 16th that cannot be refined (no learned hit, or more than one).
+struct LearnRefinement {
+    int16_t offset_sum[MAX_COARSE_CELLS];
+    uint8_t samples[MAX_COARSE_CELLS];
+    uint8_t bars_left;
+};
+
+constexpr int HISTOGRAM_PLANES = 3;                              // bits per tick counter
+constexpr int HISTOGRAM_MAX = (1 << HISTOGRAM_PLANES) - 1;        // saturated counter
+constexpr int HISTOGRAM_SEED = 5;       // counter of a hit in a freshly learned bar
+constexpr int HISTOGRAM_THRESHOLD = 4;  // counter from which a tick is part of the learned bar
+
+// Per-tick saturating hit counters of a locked channel, bit-sliced: plane k holds bit k of
+// every tick's counter, so a bar updates all the counters with a few operations per word.
+// The learned bar is the ticks whose counter reaches HISTOGRAM_THRESHOLD.
+struct HitHistogram {
+    PatternBits planes[HISTOGRAM_PLANES];
+    uint32_t model;   // fingerprint of the learned bar the counters stand for
+};
+
+constexpr int GROOVE_CACHE_SIZE = 8;  // remembered grooves per channel
+
+// A learned bar kept after its lock ended, so that switching back to it relocks at once.
+// `fingerprint` (see patternFingerprint) rejects most non-identical bars without comparing
+// them; `last_used` orders the entries for replacement, 0 marking an empty entry.
+struct KnownGroove {
+    PatternBits bits;
+    uint32_t fingerprint;
+    uint32_t last_used;
+    uint16_t hit_count;
+    uint16_t ppqn;           // grid the groove was learned on
+    uint16_t ticks_per_bar;
+    bool coarse;             // locked on the 16th grid (see coarseSimilarity)
+};
+
+// Least recently used cache of one channel's grooves.
+struct GrooveCache {
+    KnownGroove entries[GROOVE_CACHE_SIZE];
+    uint32_t use_counter;
+};
+
+constexpr int MAX_PHRASE_BARS = 8;   // longest learned phrase
+constexpr int PHRASE_PERIODS = 3;    // phrase lengths tried besides one bar (see phrasePeriod)
+
+// Phrase length tried by period detector `index`: 2, 4 or 8 bars.
+inline int phrasePeriod(int index) {
+    return 2 << index;
+}
+
+// The last MAX_PHRASE_BARS completed bars of one channel, `head` holding the newest.
+struct BarHistory {
+    PatternBits bars[MAX_PHRASE_BARS];
+    uint16_t hit_counts[MAX_PHRASE_BARS];
+    uint8_t head;
+    uint8_t count;           // bars held, 0..MAX_PHRASE_BARS
+    uint32_t epoch;          // pattern epoch the bars belong to (see syncHistory)
+};
+
+// A learned phrase of up to MAX_PHRASE_BARS bars. Bar n since the reset plays
+// bars[n % length], so a reset at bar 1 also restarts the phrase.
+struct LearnedPhrase {
+    PatternBits bars[MAX_PHRASE_BARS];
+    uint16_t hit_counts[MAX_PHRASE_BARS];
+};
+
+// The hits of one learned bar in tick order, so the injection stages walk them instead of
+// rescanning the bar. A hit's neighbours are the entries beside it; `beats` lists the
+// quarters with a hit on their first tick. `bar`, `ticks_per_bar` and `ppqn` record what
+// was indexed (see hitIndexCurrent).
+struct HitIndex {
+    PatternBits bar;
+    uint16_t ticks_per_bar;
+    uint16_t ppqn;
+    uint16_t count;
+    uint16_t positions[MAX_TICKS_PER_BAR];
+    uint8_t beat_count;
+    uint8_t beats[MAX_BAR_QUARTERS];
+};
+
+// Incoming clock as seen by the internal tick grid: each pulse is split into `multiplier`
+// internal ticks spaced by the smoothed period, and a single missing pulse is flywheeled.
+// Times are samples since the last anchor (a real edge or a flywheel edge).
+struct ClockTracker {
+    uint32_t period_q8;      // smoothed incoming period in 1/256 samples, 0 until measured
+    uint8_t multiplier;      // internal ticks per incoming pulse
+    uint8_t ticks_emitted;   // internal ticks emitted since the anchor, including its own
+    uint8_t missed_edges;    // consecutive edges synthesised by the flywheel
+    bool has_edge;           // at least one real edge seen, so the next one can be measured
+    bool stopped;            // clock timed out; position and learning are frozen
+};
+
+constexpr int ONSET_HISTORY_WORDS = 32;   // incoming pulses of hits kept for Auto Grid
+constexpr int ONSET_HISTORY_BITS = ONSET_HISTORY_WORDS * 32;
+constexpr int GRID_DETECT_MIN_HITS = 8;   // hits needed before the input's period is trusted
+
+// Hits of every channel at incoming clock pulse resolution: bit p % ONSET_HISTORY_BITS is
+// set when some channel had a hit at pulse p. `pulse` is the pulse now playing.
+struct OnsetHistory {
+    uint32_t words[ONSET_HISTORY_WORDS];
+    uint32_t pulse;
 };
 
 struct InjectionConfig {
@@ -59,29 +227,86 @@ struct InjectionConfig {
 struct _FuelInjector_DTC {
     uint32_t clock_tick_counter;
     uint32_t bar_counter;
-    uint32_t bars_since_lock;
     uint32_t samples_since_clock;
+    uint32_t samples_since_tick;
     uint32_t last_clock_period_samples;
+    ClockTracker clock;
     uint16_t current_bar_position;
     uint16_t trigger_active_steps_remaining[MAX_CHANNELS];
+
+    // Auto Grid: bar inferred from the input (bar_length 0 until one is), clock pulses since
+    // the last reset and the previous reset span (0 until measured).
+    uint8_t inferred_ppqn_index;
+    uint8_t inferred_bar_length;
+    bool grid_from_reset;       // the inferred bar comes from the reset spacing
+    bool grid_check_due;        // a bar ended while learning: look for the input's period
+    uint16_t pulses_since_reset;
+    uint16_t reset_span;
     float prev_clock_value;
     float prev_reset_value;
     float prev_trigger_value[MAX_CHANNELS];
     XorShift32 prng;
-    FuelInjectorState state;
-    bool is_injection_bar;
+    FuelInjectorState state;    // summary of the channel states (the most advanced one)
+    bool is_injection_bar;      // some channel is playing an injection this bar
     uint8_t current_bar_index;
     
-    // State machine tracking
-    uint8_t stable_bars_count;
+    // State machine tracking: one learning state machine per channel. Grouped channels
+    // follow the state machine of the group's first channel, copied onto every member.
     uint8_t required_stable_bars;
+    uint8_t channel_state[MAX_CHANNELS];      // FuelInjectorState
+    uint8_t stable_bars_count[MAX_CHANNELS];
+    uint8_t group_leader[MAX_CHANNELS];
+    uint16_t bars_since_lock[MAX_CHANNELS];
+    uint8_t phrase_length[MAX_CHANNELS];      // bars in the locked phrase (1 = a single bar)
+    // Per phrase period: consecutive bars that matched the bar one period before.
+    uint8_t phrase_matches[MAX_CHANNELS][PHRASE_PERIODS];
+
+    // Bumped to discard every recorded and learned pattern at once (see syncPattern).
+    uint32_t pattern_epoch;
+    // Internal tick grid the patterns are recorded on (0 until the first block).
+    uint16_t grid_ppqn;
+    uint16_t grid_ticks_per_bar;
+
+    // Variation bank: ready slots, last-played slot (-1 = none yet) and the phrase bar the
+    // ready slots were rendered from (-1 = the learned bar) per channel, plus the round-robin
+    // cursor used to fill empty slots one per block.
+    uint8_t variation_ready[MAX_CHANNELS];
+    int8_t active_variation[MAX_CHANNELS];
+    int8_t bank_phrase_bar[MAX_CHANNELS];
+    uint8_t gen_channel;
+
+    // Injection playback: next event in the active variation and the current trigger voltage.
+    uint16_t play_cursor[MAX_CHANNELS];
+    float trigger_level[MAX_CHANNELS];
+
+    // Hits of the comparison bar (the learned bar when locked, the previous bar while
+    // learning) whose tick passed without an incoming hit in the current bar.
+    uint16_t missed_hits[MAX_CHANNELS];
+    uint8_t fast_lock_blocked;   // channels that relearned mid-bar: no fast lock this bar
+    uint8_t coarse_locked;       // channels locked on the 16th grid (see coarseSimilarity)
+    uint8_t carried_hits;        // channels with an early hit owed to the next downbeat
+    uint8_t unlocked_this_bar;   // channels that left a lock in the current bar
+    uint8_t unlocked_last_bar;   // ... and in the bar before (see realignBarPhase)
+
+    // Off-grid events of the current tick, as samples after the tick (ascending).
+    uint32_t pending_due[MAX_CHANNELS][MAX_PENDING_EVENTS];
+    uint8_t pending_level[MAX_CHANNELS][MAX_PENDING_EVENTS];
+    uint8_t pending_count[MAX_CHANNELS];
 };
 
 #ifdef _DISTINGNT_API_H
 struct _FuelInjectorAlgorithm : _NT_algorithm {
     ChannelPattern patterns[MAX_CHANNELS];
+    LearnRefinement refinement[MAX_CHANNELS];
+    PatternBits learned_window[MAX_CHANNELS];   // learned bar widened by the Tolerance setting
+    OnsetHistory onsets;
     ChannelPattern* learned_patterns;
-    bool (*output_patterns)[MAX_TICKS_PER_BAR];
+    HitHistogram* histograms;
+    GrooveCache* groove_caches;
+    BarHistory* bar_histories;
+    LearnedPhrase* phrases;
+    HitIndex* hit_indices;
+    EventList* output_events;
     InjectionConfig injection_config;
     _FuelInjector_DTC* dtc;
     
@@ -95,18 +320,26 @@ struct _FuelInjectorAlgorithm : _NT_algorithm {
     _NT_parameterPages paramPages;      // pages wrapper struct
     int numChannels;                     // number of active channels
     
-    _FuelInjectorAlgorithm() : learned_patterns(nullptr), output_patterns(nullptr), dtc(nullptr),
+    _FuelInjectorAlgorithm() : learned_patterns(nullptr), histograms(nullptr), groove_caches(nullptr), bar_histories(nullptr), phrases(nullptr), hit_indices(nullptr), output_events(nullptr), dtc(nullptr),
                                 params(nullptr), numParams(0), pages(nullptr), numPages(2),
                                 controlPageParams(nullptr), routingPageParams(nullptr), numChannels(0) {}
 #else
 struct _FuelInjectorAlgorithm {
     ChannelPattern patterns[MAX_CHANNELS];
+    LearnRefinement refinement[MAX_CHANNELS];
+    PatternBits learned_window[MAX_CHANNELS];   // learned bar widened by the Tolerance setting
+    OnsetHistory onsets;
     ChannelPattern* learned_patterns;
-    bool (*output_patterns)[MAX_TICKS_PER_BAR];
+    HitHistogram* histograms;
+    GrooveCache* groove_caches;
+    BarHistory* bar_histories;
+    LearnedPhrase* phrases;
+    HitIndex* hit_indices;
+    EventList* output_events;
     InjectionConfig injection_config;
     _FuelInjector_DTC* dtc;
     
-    _FuelInjectorAlgorithm() : learned_patterns(nullptr), output_patterns(nullptr), dtc(nullptr) {}
+    _FuelInjectorAlgorithm() : learned_patterns(nullptr), histograms(nullptr), groove_caches(nullptr), bar_histories(nullptr), phrases(nullptr), hit_indices(nullptr), output_events(nullptr), dtc(nullptr) {}
 #endif  // _DISTINGNT_API_H
 };
 
@@ -114,6 +347,49 @@ inline bool detectRisingEdge(float current, float previous, float threshold) {
     return current > threshold && previous <= threshold;
 }
 
+// Block front end: each bus in a block is scanned once for rising edges, which are
+// OR-ed into a per-frame mask. The masks are then compacted into a frame-ordered event
+// list so the state machine only runs on frames where something actually happened.
+constexpr int MAX_SCAN_FRAMES = 128;
+
+enum FrameEventBits : uint16_t {
+    // Bits 0..MAX_CHANNELS-1 flag a trigger edge on that channel.
+    FRAME_EVENT_CLOCK = 1 << MAX_CHANNELS,
+    FRAME_EVENT_RESET = 1 << (MAX_CHANNELS + 1)
+};
+
+struct FrameEvent {
+    uint16_t frame;
+    uint16_t mask;
+};
+
+inline int scanRisingEdges(const float* samples, int num_frames, float& previous, float threshold,
+                           uint16_t* edge_masks, uint16_t bit) {
+    int count = 0;
+    float last = previous;
+    for (int i = 0; i < num_frames; i++) {
+        const float current = samples[i];
+        const int edge = (current >= threshold) & (last < threshold);
+        edge_masks[i] |= (uint16_t)(-edge & bit);
+        count += edge;
+        last = current;
+    }
+    previous = last;
+    return count;
+}
+
+inline int buildFrameEvents(const uint16_t* edge_masks, int num_frames, FrameEvent* events) {
+    int count = 0;
+    for (int i = 0; i < num_frames; i++) {
+        if (edge_masks[i] != 0) {
+            events[count].frame = (uint16_t)i;
+            events[count].mask = edge_masks[i];
+            count++;
+        }
+    }
+    return count;
+}
+
 inline int incrementTick(int current_tick) {
     return current_tick + 1;
 }
@@ -132,6 +408,128 @@ inline bool isClockTimeout(int samples_since_clock, int timeout_threshold) {
     return samples_since_clock >= timeout_threshold;
 }
 
+constexpr int CLOCK_FLYWHEEL_EDGES = 1;  // missing pulses bridged before the grid stops
+
+// Start tracking from scratch with the given multiplier; nothing is owed until the next edge.
+inline void resetClockTracker(ClockTracker& t, int multiplier) {
+    t.period_q8 = 0;
+    t.multiplier = (uint8_t)multiplier;
+    t.ticks_emitted = (uint8_t)multiplier;
+    t.missed_edges = 0;
+    t.has_edge = false;
+    t.stopped = false;
+}
+
+// Restart the grid from a reset while stopped: the next edge is a fresh tick 0 and the gap
+// before it is not a period. The learned period is kept.
+inline void clockTrackerRestart(ClockTracker& t) {
+    t.ticks_emitted = t.multiplier;
+    t.missed_edges = 0;
+    t.has_edge = false;
+}
+
+// Fold a measured period into the estimate. Jitter (within 1/8 of the period) is averaged
+// over about 8 pulses; larger jumps are tempo changes and are taken as-is.
+inline uint32_t smoothClockPeriod(uint32_t period_q8, uint32_t measured) {
+    const uint32_t m = measured << 8;
+    if (period_q8 == 0) {
+        return m;
+    }
+    const uint32_t diff = (m > period_q8) ? m - period_q8 : period_q8 - m;
+    if (diff > period_q8 / 8) {
+        return m;
+    }
+    return period_q8 - (period_q8 >> 3) + (m >> 3);
+}
+
+// Samples after the anchor at which the next internal tick is due: the remaining ticks of
+// the current pulse, then the flywheel edge. UINT32_MAX when nothing is scheduled.
+inline uint32_t nextInternalTickDue(const ClockTracker& t) {
+    if (t.period_q8 == 0 || t.stopped) {
+        return UINT32_MAX;
+    }
+    if (t.ticks_emitted < t.multiplier) {
+        return (uint32_t)(((uint64_t)t.period_q8 * t.ticks_emitted / t.multiplier) >> 8);
+    }
+    if (t.missed_edges < CLOCK_FLYWHEEL_EDGES) {
+        return t.period_q8 >> 8;
+    }
+    return UINT32_MAX;
+}
+
+// Consume the scheduled tick once it is due. A flywheel edge becomes the new anchor, placed
+// where the edge was predicted rather than where it was noticed.
+inline void clockTrackerAdvance(ClockTracker& t, uint32_t& samples_since_anchor) {
+    if (t.ticks_emitted < t.multiplier) {
+        t.ticks_emitted++;
+        return;
+    }
+    const uint32_t due = t.period_q8 >> 8;
+    samples_since_anchor = (samples_since_anchor > due) ? samples_since_anchor - due : 0;
+    t.ticks_emitted = 1;
+    t.missed_edges++;
+}
+
+// A real clock edge. Returns how many internal ticks to emit now: those still owed from the
+// last pulse (the edge came early) plus the edge's own tick. An edge arriving shortly after
+// a flywheel edge is that edge running late, so it only re-phases the grid.
+inline int clockTrackerEdge(ClockTracker& t, uint32_t& samples_since_anchor) {
+    const uint32_t period = t.period_q8 >> 8;
+    const uint32_t elapsed = samples_since_anchor;
+    samples_since_anchor = 0;
+
+    if (t.stopped) {
+        // Resuming: the flywheel already emitted this edge's tick before the clock stopped.
+        t.stopped = false;
+        if (t.missed_edges > 0) {
+            t.missed_edges = 0;
+            return 0;
+        }
+    }
+    if (t.missed_edges > 0 && elapsed < period / 2) {
+        t.period_q8 = smoothClockPeriod(t.period_q8, period + elapsed);
+        t.missed_edges = 0;
+        return 0;
+    }
+
+    // A pulse counts as measured only between two real edges, or right after a flywheel
+    // edge when it arrives on time (a resumed clock is not a tempo).
+    if (t.has_edge && (t.missed_edges == 0 || elapsed < 2 * period)) {
+        t.period_q8 = smoothClockPeriod(t.period_q8, elapsed);
+    }
+    const int owed = t.multiplier - t.ticks_emitted;
+    t.ticks_emitted = 1;
+    t.missed_edges = 0;
+    t.has_edge = true;
+    return (owed > 0 ? owed : 0) + 1;
+}
+
+// The clock counts as stopped once the flywheel has bridged all it may and the following
+// edge is half a period overdue.
+inline bool isClockStopped(const ClockTracker& t, uint32_t samples_since_anchor) {
+    if (t.period_q8 == 0 || t.missed_edges < CLOCK_FLYWHEEL_EDGES) {
+        return false;
+    }
+    const uint32_t period = t.period_q8 >> 8;
+    return isClockTimeout((int)samples_since_anchor, (int)(period + period / 2));
+}
+
+// Samples per internal tick, or 0 while the clock has not been measured.
+inline uint32_t internalTickPeriod(const ClockTracker& t) {
+    return (t.multiplier > 0) ? (t.period_q8 / t.multiplier) >> 8 : 0;
+}
+
+// Internal ticks per incoming pulse: the requested multiplier, reduced until the internal
+// grid fits MAX_PPQN and a whole bar still fits MAX_TICKS_PER_BAR.
+inline int effectiveClockMultiplier(int clock_ppqn, int requested, int bar_length_qn) {
+    int multiplier = (requested > 1) ? requested : 1;
+    while (multiplier > 1 &&
+           (clock_ppqn * multiplier > MAX_PPQN || clock_ppqn * multiplier * bar_length_qn > MAX_TICKS_PER_BAR)) {
+        multiplier--;
+    }
+    return multiplier;
+}
+
 struct MidiClockState {
     int midi_tick_count;
     bool midi_running;
@@ -159,49 +557,550 @@ inline int convertMidiTicksToInternal(int midi_ticks, int internal_ppqn) {
     return midi_ticks * (internal_ppqn / 24);
 }
 
+// Portable SWAR popcount; Cortex-M7 has no popcount instruction and the plugin is
+// linked without libgcc, so __builtin_popcount is not an option.
+inline int popcount32(uint32_t v) {
+    v = v - ((v >> 1) & 0x55555555u);
+    v = (v & 0x33333333u) + ((v >> 2) & 0x33333333u);
+    v = (v + (v >> 4)) & 0x0F0F0F0Fu;
+    return (int)((v * 0x01010101u) >> 24);
+}
+
+inline int countHits(const PatternBits& bits) {
+    int count = 0;
+    for (int i = 0; i < PATTERN_WORDS; i++) {
+        count += popcount32(bits.words[i]);
+    }
+    return count;
+}
+
+inline int countCommonHits(const PatternBits& a, const PatternBits& b) {
+    int count = 0;
+    for (int i = 0; i < PATTERN_WORDS; i++) {
+        count += popcount32(a.words[i] & b.words[i]);
+    }
+    return count;
+}
+
+inline int countCombinedHits(const PatternBits& a, const PatternBits& b) {
+    int count = 0;
+    for (int i = 0; i < PATTERN_WORDS; i++) {
+        count += popcount32(a.words[i] | b.words[i]);
+    }
+    return count;
+}
+
+// First hit at or after `tick` and before `limit`, or -1 when there is none.
+// Skips empty words, so walking all hits costs O(words + hits) instead of O(ticks).
+inline int findNextHit(const PatternBits& bits, int tick, int limit) {
+    if (tick >= limit) {
+        return -1;
+    }
+    int word = tick >> 5;
+    uint32_t pending = bits.words[word] & (~0u << (tick & 31));
+    while (pending == 0) {
+        word++;
+        if (word >= PATTERN_WORDS || (word << 5) >= limit) {
+            return -1;
+        }
+        pending = bits.words[word];
+    }
+    int hit = (word << 5) + __builtin_ctz(pending);
+    return (hit < limit) ? hit : -1;
+}
+
+// Shift every hit `shift` ticks later (earlier when negative), whole words at a time; hits
+// moved outside the bit array are dropped.
+inline void shiftBits(const PatternBits& in, int shift, PatternBits& out) {
+    const int word_shift = ((shift < 0) ? -shift : shift) >> 5;
+    const int bit_shift = ((shift < 0) ? -shift : shift) & 31;
+    for (int i = 0; i < PATTERN_WORDS; i++) {
+        const int src = (shift >= 0) ? i - word_shift : i + word_shift;
+        const int carry = (shift >= 0) ? src - 1 : src + 1;
+        uint32_t w = 0;
+        if (src >= 0 && src < PATTERN_WORDS) {
+            w = (shift >= 0) ? in.words[src] << bit_shift : in.words[src] >> bit_shift;
+        }
+        if (bit_shift != 0 && carry >= 0 && carry < PATTERN_WORDS) {
+            w |= (shift >= 0) ? in.words[carry] >> (32 - bit_shift) : in.words[carry] << (32 - bit_shift);
+        }
+        out.words[i] = w;
+    }
+}
+
+// Clear every tick at or after `limit`.
+inline void clearFromTick(PatternBits& bits, int limit) {
+    for (int i = 0; i < PATTERN_WORDS; i++) {
+        const int first = i << 5;
+        if (first >= limit) {
+            bits.words[i] = 0;
+        } else if (limit - first < 32) {
+            bits.words[i] &= (1u << (limit - first)) - 1u;
+        }
+    }
+}
+
+// Rotate a looping `limit`-tick bar `shift` ticks later (0 <= shift < limit); hits pushed
+// past the bar end come round to the start.
+inline void rotateBits(const PatternBits& in, int shift, int limit, PatternBits& out) {
+    PatternBits wrapped;
+    shiftBits(in, shift, out);
+    shiftBits(in, shift - limit, wrapped);
+    for (int i = 0; i < PATTERN_WORDS; i++) {
+        out.words[i] |= wrapped.words[i];
+    }
+    clearFromTick(out, limit);
+}
+
+// Widen every hit of a looping `limit`-tick bar to the ticks within `radius` of it (wrapping
+// round the bar ends), by OR-ing rotated copies. Each step doubles the width covered, so
+// a radius of r costs about log2(r) passes over the words rather than one per tick.
+inline void dilateBits(const PatternBits& in, int radius, int limit, PatternBits& out) {
+    out = in;
+    if (radius > limit / 2) radius = limit / 2;
+    PatternBits later;
+    PatternBits earlier;
+    for (int step = 1; radius > 0; step *= 2) {
+        const int s = (step < radius) ? step : radius;
+        rotateBits(out, s, limit, later);
+        rotateBits(out, limit - s, limit, earlier);
+        for (int i = 0; i < PATTERN_WORDS; i++) {
+            out.words[i] |= later.words[i] | earlier.words[i];
+        }
+        radius -= s;
+    }
+}
+
+// Circular cross-correlation: the rotation of `bar` (ticks later, 0..limit-1) that puts the
+// most of its hits on `reference`. Only offsets up to `window` ticks either way are tried,
+// which bounds the cost; nearest zero first, so a tie keeps the smaller correction.
+// `matched` receives the overlap at that rotation.
+inline int bestRotation(const PatternBits& bar, const PatternBits& reference, int limit, int window, int& matched) {
+    const int hits = countHits(bar);
+    PatternBits rotated;
+    int best = 0;
+    matched = countCommonHits(bar, reference);
+    if (window > limit / 2) window = limit / 2;
+    for (int d = 1; d <= window && matched < hits; d++) {
+        const int candidates[2] = { d, limit - d };
+        for (int k = 0; k < 2; k++) {
+            if (k == 1 && candidates[1] == d) continue;
+            rotateBits(bar, candidates[k], limit, rotated);
+            const int m = countCommonHits(rotated, reference);
+            if (m > matched) {
+                matched = m;
+                best = candidates[k];
+            }
+        }
+    }
+    return best;
+}
+
+// Record a generated hit at a sub-tick position: on the grid when it lands exactly on a
+// tick, otherwise in the off-grid list. Without a list, or once it is full, the hit is
+// rounded down onto the grid instead.
+inline void placeFineHit(PatternBits* grid, OffGridHits* off_grid, uint32_t position) {
+    if ((position % SUBTICKS_PER_TICK) != 0 && off_grid && off_grid->count < MAX_OFF_GRID_HITS) {
+        off_grid->positions[off_grid->count++] = position;
+    } else {
+        grid->set((int)(position / SUBTICKS_PER_TICK));
+    }
+}
+
+// Build a sorted full-level event list from a bar's grid hits plus any off-grid hits.
+// Returns the number of events, or -1 when they do not fit and the bar is kept as a grid.
+inline int compileEvents(const PatternBits& bits, int limit, EventList& list,
+                         const OffGridHits* off_grid = nullptr) {
+    uint32_t extra[MAX_OFF_GRID_HITS];
+    int extraCount = 0;
+    if (off_grid) {
+        for (int i = 0; i < off_grid->count; i++) {
+            const uint32_t pos = off_grid->positions[i];
+            if (pos >= (uint32_t)limit * SUBTICKS_PER_TICK) {
+                continue;
+            }
+            int j = extraCount++;
+            while (j > 0 && extra[j - 1] > pos) {
+                extra[j] = extra[j - 1];
+                j--;
+            }
+            extra[j] = pos;
+        }
+    }
+
+    int count = 0;
+    int e = 0;
+    uint32_t last = ~0u;
+    bool fits = true;
+    for (int i = findNextHit(bits, 0, limit); fits; i = findNextHit(bits, i + 1, limit)) {
+        const uint32_t gridPos = (i >= 0) ? (uint32_t)i * SUBTICKS_PER_TICK : ~0u;
+        while (e < extraCount && extra[e] < gridPos && fits) {
+            fits = extra[e] == last || count < MAX_BAR_EVENTS;
+            if (extra[e] != last && fits) {
+                list.events[count].tick = (uint16_t)(extra[e] / SUBTICKS_PER_TICK);
+                list.events[count].offset = (uint8_t)(extra[e] % SUBTICKS_PER_TICK);
+                list.events[count].level = 255;
+                last = extra[e];
+                count++;
+            }
+            e++;
+        }
+        if (i < 0 || !fits) {
+            break;
+        }
+        fits = count < MAX_BAR_EVENTS;
+        if (fits) {
+            list.events[count].tick = (uint16_t)i;
+            list.events[count].offset = 0;
+            list.events[count].level = 255;
+            last = gridPos;
+            count++;
+        }
+    }
+
+    list.overflow = !fits;
+    if (fits) {
+        list.count = (uint16_t)count;
+        return count;
+    }
+    list.count = 0;
+    list.grid = bits;
+    for (int k = 0; k < extraCount; k++) {
+        list.grid.set((int)(extra[k] / SUBTICKS_PER_TICK));
+    }
+    clearFromTick(list.grid, limit);
+    return -1;
+}
+
+// Move the cursor to the first event at or after `tick` and return how many events fall on
+// `tick`; the caller consumes them and advances the cursor. Ticks are expected in increasing
+// order; the cursor rewinds if playback moves backwards.
+inline int eventsAtTick(const EventList& list, uint16_t& cursor, int tick) {
+    if (cursor > list.count || (cursor > 0 && list.events[cursor - 1].tick >= tick)) {
+        cursor = 0;
+    }
+    while (cursor < list.count && list.events[cursor].tick < tick) {
+        cursor++;
+    }
+    int n = 0;
+    while (cursor + n < list.count && list.events[cursor + n].tick == tick) {
+        n++;
+    }
+    return n;
+}
+
 struct PatternLearner {
     FuelInjectorState state;
     int stable_bars_count;
     int required_stable_bars;
 };
 
-inline void recordHit(ChannelPattern& pattern, int bar_index, int tick_position) {
-    if (tick_position >= 0 && tick_position < MAX_TICKS_PER_BAR) {
+// bar_index 0 is the bar being recorded, 1 the previous bar.
+inline int recordedSlot(const ChannelPattern& pattern, int bar_index) {
+    return pattern.current_slot ^ (bar_index & 1);
+}
+
+inline const PatternBits& recordedBar(const ChannelPattern& pattern, int bar_index) {
+    static const PatternBits empty = {};
+    const int slot = recordedSlot(pattern, bar_index);
+    return (pattern.stale_slots & (1 << slot)) ? empty : pattern.bars[slot];
+}
+
+inline uint16_t recordedHitCount(const ChannelPattern& pattern, int bar_index) {
+    const int slot = recordedSlot(pattern, bar_index);
+    return (pattern.stale_slots & (1 << slot)) ? 0 : pattern.hit_counts[slot];
+}
+
+// A stale slot reads as an empty bar, so it has nothing in common with anything.
+inline uint16_t recordedCommonHits(const ChannelPattern& pattern) {
+    return pattern.stale_slots ? 0 : pattern.common_hits;
+}
+
+inline uint16_t recordedReferenceHits(const ChannelPattern& pattern) {
+    return (pattern.stale_slots & (1 << pattern.current_slot)) ? 0 : pattern.reference_hits;
+}
+
+// Bring a pattern up to the current epoch: a pattern from an older epoch is emptied in
+// O(1) by marking both slots stale; the bars themselves are cleared when next recorded.
+inline ChannelPattern& syncPattern(ChannelPattern& pattern, uint32_t epoch) {
+    if (pattern.epoch != epoch) {
+        pattern.epoch = epoch;
+        pattern.current_slot = 0;
+        pattern.stale_slots = (1 << 0) | (1 << 1);
+        pattern.has_stable_pattern = false;
+    }
+    return pattern;
+}
+
+// Replace the pattern with a single bar (used for learned snapshots).
+inline void loadBar(ChannelPattern& pattern, const PatternBits& bits, uint16_t hit_count) {
+    pattern.current_slot = 0;
+    pattern.stale_slots = 1 << 1;
+    pattern.bars[0] = bits;
+    pattern.hit_counts[0] = hit_count;
+    pattern.common_hits = 0;
+    pattern.reference_hits = 0;
+}
+
+// Map a learned bar onto another tick grid. A PPQN change scales positions; a longer bar
+// repeats the learned beats from the downbeat and a shorter one drops the tail. Returns false
+// when the mapping is lossy: a hit falls between ticks of the new grid, or no hit survives.
+inline bool resampleBar(const PatternBits& in, int from_ppqn, int from_ticks, int to_ppqn, int to_ticks,
+                        PatternBits& out, uint16_t& hit_count) {
+    out.clear();
+    hit_count = 0;
+    if (from_ppqn <= 0 || to_ppqn <= 0 || to_ticks > MAX_TICKS_PER_BAR) {
+        return false;
+    }
+    // The learned bar's length on the new grid: the period at which it repeats.
+    const int cycle = (from_ticks / from_ppqn) * to_ppqn;
+    if (cycle <= 0) {
+        return false;
+    }
+    bool any = false;
+    for (int i = findNextHit(in, 0, from_ticks); i >= 0; i = findNextHit(in, i + 1, from_ticks)) {
+        any = true;
+        if ((i * to_ppqn) % from_ppqn != 0) {
+            return false;
+        }
+        for (int j = i * to_ppqn / from_ppqn; j < to_ticks; j += cycle) {
+            out.set(j);
+            hit_count++;
+        }
+    }
+    return !any || hit_count > 0;
+}
+
+// Hit positions as gaps from the previous hit (the first one from tick 0), so a saved
+// pattern is a short list of small numbers. Returns the number of values written.
+inline int encodeHitDeltas(const PatternBits& bits, int limit, uint16_t* deltas) {
+    int count = 0;
+    int prev = 0;
+    for (int i = findNextHit(bits, 0, limit); i >= 0; i = findNextHit(bits, i + 1, limit)) {
+        deltas[count++] = (uint16_t)(i - prev);
+        prev = i;
+    }
+    return count;
+}
+
+// Inverse of encodeHitDeltas. Returns false when a position falls outside the bar or two
+// hits coincide.
+inline bool decodeHitDeltas(const uint16_t* deltas, int count, int limit, PatternBits& out, uint16_t& hit_count) {
+    out.clear();
+    hit_count = 0;
+    int pos = 0;
+    for (int i = 0; i < count; i++) {
+        if (i > 0 && deltas[i] == 0) {
+            return false;
+        }
+        pos += deltas[i];
+        if (pos >= limit || pos >= MAX_TICKS_PER_BAR) {
+            return false;
+        }
+        out.set(pos);
+        hit_count++;
+    }
+    return true;
+}
+
+// Record a hit and keep the overlap counts up to date, so comparing bars at the bar
+// boundary needs no scan. `reference` (the learned bar, optional) is compared against
+// hits in the current bar.
+inline void recordHit(ChannelPattern& pattern, int bar_index, int tick_position,
+                      const PatternBits* reference = nullptr) {
+    if (tick_position < 0 || tick_position >= MAX_TICKS_PER_BAR || (bar_index != 0 && bar_index != 1)) {
+        return;
+    }
+    const int slot = recordedSlot(pattern, bar_index);
+    if (pattern.stale_slots & (1 << slot)) {
+        pattern.bars[slot].clear();
+        pattern.hit_counts[slot] = 0;
+        pattern.stale_slots &= ~(1 << slot);
+        pattern.common_hits = 0;
         if (bar_index == 0) {
-            pattern.hit_positions_bar1[tick_position] = 1;
-            pattern.hit_count_bar1++;
-        } else if (bar_index == 1) {
-            pattern.hit_positions_bar2[tick_position] = 1;
-            pattern.hit_count_bar2++;
+            pattern.reference_hits = 0;
+        }
+    }
+    if (pattern.bars[slot].test(tick_position)) {
+        return;
+    }
+    pattern.bars[slot].set(tick_position);
+    pattern.hit_counts[slot]++;
+    if (recordedBar(pattern, bar_index ^ 1).test(tick_position)) {
+        pattern.common_hits++;
+    }
+    if (bar_index == 0 && reference != nullptr && reference->test(tick_position)) {
+        pattern.reference_hits++;
+    }
+}
+
+// Rotate both recorded bars in place. Their hit and overlap counts are unchanged; the
+// caller recounts `reference_hits` against its reference.
+inline void rotateRecordedBars(ChannelPattern& pattern, int shift, int limit) {
+    PatternBits rotated;
+    for (int slot = 0; slot < 2; slot++) {
+        if (!(pattern.stale_slots & (1 << slot))) {
+            rotateBits(pattern.bars[slot], shift, limit, rotated);
+            pattern.bars[slot] = rotated;
         }
     }
 }
 
-inline float calculatePatternSimilarity(const ChannelPattern& pattern) {
-    if (pattern.hit_count_bar1 == 0 && pattern.hit_count_bar2 == 0) {
+// Jaccard similarity in percent from hit counts; two empty bars are identical.
+inline float similarityFromCounts(int hits_a, int hits_b, int common) {
+    const int combined = hits_a + hits_b - common;
+    if (combined <= 0) {
         return 100.0f;
     }
-    
-    int matching_hits = 0;
-    int total_hits = 0;
-    
-    for (int i = 0; i < MAX_TICKS_PER_BAR; i++) {
-        bool bar1_hit = pattern.hit_positions_bar1[i] > 0;
-        bool bar2_hit = pattern.hit_positions_bar2[i] > 0;
-        
-        if (bar1_hit && bar2_hit) {
-            matching_hits++;
+    return (common * 100.0f) / combined;
+}
+
+constexpr int MIN_INFERRED_BAR_PULSES = 4;  // a 4/4 bar of a 1 PPQN clock
+
+// Start pulse `pulse + 1`. The bit after it is cleared ahead, so a hit rounded up to the
+// following pulse (see onsetRecord) survives until that pulse starts.
+inline void onsetAdvance(OnsetHistory& h) {
+    h.pulse++;
+    const uint32_t ahead = (h.pulse + 1) % ONSET_HISTORY_BITS;
+    h.words[ahead / 32] &= ~(1u << (ahead % 32));
+}
+
+// Note a hit at the current pulse, or at the next one when `round_up`.
+inline void onsetRecord(OnsetHistory& h, bool round_up) {
+    const uint32_t bit = (h.pulse + (round_up ? 1 : 0)) % ONSET_HISTORY_BITS;
+    h.words[bit / 32] |= 1u << (bit % 32);
+}
+
+// Copy the completed pulses still held, oldest first, into `out` (ONSET_HISTORY_WORDS words).
+// Returns how many there are.
+inline int onsetWindow(const OnsetHistory& h, uint32_t* out) {
+    // The current pulse and the one cleared ahead of it are not complete.
+    const int count = (h.pulse < (uint32_t)(ONSET_HISTORY_BITS - 2)) ? (int)h.pulse : ONSET_HISTORY_BITS - 2;
+    for (int i = 0; i < ONSET_HISTORY_WORDS; i++) out[i] = 0;
+    for (int j = 0; j < count; j++) {
+        const uint32_t bit = (h.pulse - (uint32_t)count + (uint32_t)j) % ONSET_HISTORY_BITS;
+        if (h.words[bit / 32] & (1u << (bit % 32))) {
+            out[j / 32] |= 1u << (j % 32);
         }
-        if (bar1_hit || bar2_hit) {
-            total_hits++;
+    }
+    return count;
+}
+
+// The 32 bits of `bits` from bit `start` on; bits before 0 read as 0.
+inline uint32_t bitsFrom(const uint32_t* bits, int start) {
+    if (start <= -32) return 0;
+    if (start < 0) return bits[0] << -start;
+    const int word = start / 32;
+    const int shift = start % 32;
+    if (shift == 0) return bits[word];
+    const uint32_t high = (word + 1 < ONSET_HISTORY_WORDS) ? bits[word + 1] << (32 - shift) : 0;
+    return (bits[word] >> shift) | high;
+}
+
+// Set bits among the first `count` of `bits` from bit `from` on.
+inline int countBitsFrom(const uint32_t* bits, int from, int count) {
+    int hits = 0;
+    for (int i = 0; i * 32 < count; i++) {
+        uint32_t word = bits[i];
+        if (i * 32 + 32 > count) word &= (1u << (count - i * 32)) - 1;
+        if (i * 32 < from) word &= (from - i * 32 >= 32) ? 0u : ~((1u << (from - i * 32)) - 1);
+        hits += popcount32(word);
+    }
+    return hits;
+}
+
+// Hits at both t and t - lag, over the first `count` bits.
+inline int countLagMatches(const uint32_t* bits, int count, int lag) {
+    int matches = 0;
+    for (int i = 0; i * 32 < count; i++) {
+        uint32_t word = bits[i] & bitsFrom(bits, i * 32 - lag);
+        if (i * 32 + 32 > count) word &= (1u << (count - i * 32)) - 1;
+        matches += popcount32(word);
+    }
+    return matches;
+}
+
+// Bitset autocorrelation: the shortest lag at which the hits of `bits` repeat at least
+// `threshold` percent alike (see similarityFromCounts). A lag is only tried once the window
+// holds it twice over. 0 when nothing repeats yet, or too few hits to tell.
+inline int repeatPeriod(const uint32_t* bits, int count, int max_lag, float threshold) {
+    if (countBitsFrom(bits, 0, count) < GRID_DETECT_MIN_HITS) {
+        return 0;
+    }
+    for (int lag = 1; lag <= max_lag && 2 * lag <= count; lag++) {
+        const int later = countBitsFrom(bits, lag, count);
+        const int earlier = countBitsFrom(bits, 0, count - lag);
+        if (later == 0 || earlier == 0) continue;
+        if (similarityFromCounts(later, earlier, countLagMatches(bits, count, lag)) >= threshold) {
+            return lag;
         }
     }
-    
-    if (total_hits == 0) {
-        return 100.0f;
+    return 0;
+}
+
+// The bar closest to `target` pulses that the input fits: a whole number of `period`s, and
+// a whole number of them between resets `span` pulses apart (0: no resets). Candidates are
+// the bars of MIN_INFERRED_BAR_PULSES to MAX_TICKS_PER_BAR pulses that a PPQN setting and a
+// Bar Length of 1..8 quarter notes express; a bar several settings express prefers
+// `preferred_ppqn_index`, then 4/4. Returns false when no setting fits.
+inline bool nearestBarGrid(int period, int span, int target, const int* ppqn_values, int num_ppqn,
+                           int preferred_ppqn_index, int& ppqn_index, int& bar_length) {
+    int bestDistance = -1;
+    int bestPulses = 0;
+    int bestRank = 0;
+    for (int i = 0; i < num_ppqn; i++) {
+        for (int quarters = 1; quarters <= MAX_BAR_QUARTERS; quarters++) {
+            const int pulses = ppqn_values[i] * quarters;
+            if (pulses < MIN_INFERRED_BAR_PULSES || pulses > MAX_TICKS_PER_BAR || pulses % period != 0 || (span > 0 && span % pulses != 0)) {
+                continue;
+            }
+            const int distance = (pulses > target) ? pulses - target : target - pulses;
+            const int rank = (i == preferred_ppqn_index) ? 0 : (quarters == 4) ? 1 : 2;
+            if (bestDistance < 0 || distance < bestDistance ||
+                (distance == bestDistance && (pulses < bestPulses || (pulses == bestPulses && rank < bestRank)))) {
+                bestDistance = distance;
+                bestPulses = pulses;
+                bestRank = rank;
+                ppqn_index = i;
+                bar_length = quarters;
+            }
+        }
     }
-    
-    return (matching_hits * 100.0f) / total_hits;
+    return bestDistance >= 0;
+}
+
+// Similarity of the current and previous bar, from the counts kept by recordHit.
+inline float calculatePatternSimilarity(const ChannelPattern& pattern) {
+    return similarityFromCounts(recordedHitCount(pattern, 0), recordedHitCount(pattern, 1),
+                                recordedCommonHits(pattern));
+}
+
+constexpr int MAX_TOLERANCE_TICKS = 6;  // largest timing tolerance, in internal ticks
+
+// Similarity when a hit within `tolerance` ticks of one in the other bar counts as the same
+// hit. A hit of each bar is matched if it falls inside the other bar's dilated hits; the
+// smaller of the two matched counts stands in for the common hits.
+inline float toleranceSimilarity(const PatternBits& a, const PatternBits& b, int limit, int tolerance) {
+    if (tolerance <= 0) {
+        return similarityFromCounts(countHits(a), countHits(b), countCommonHits(a, b));
+    }
+    PatternBits wide_a;
+    PatternBits wide_b;
+    dilateBits(a, tolerance, limit, wide_a);
+    dilateBits(b, tolerance, limit, wide_b);
+    const int matched_a = countCommonHits(a, wide_b);
+    const int matched_b = countCommonHits(b, wide_a);
+    return similarityFromCounts(countHits(a), countHits(b), (matched_a < matched_b) ? matched_a : matched_b);
+}
+
+// A hit in the last `tolerance` ticks of a bar with no expected hit within the tolerance
+// before the bar end, but one just after the downbeat, is an early hit of the next bar.
+inline bool carriesToNextBar(const PatternBits& expected, int tick, int limit, int tolerance) {
+    const int to_downbeat = limit - tick;
+    if (tolerance <= 0 || to_downbeat > tolerance || findNextHit(expected, tick - tolerance, limit) >= 0) {
+        return false;
+    }
+    return findNextHit(expected, 0, tolerance - to_downbeat + 1) >= 0;
 }
 
 inline void updateLearningState(PatternLearner& learner, float similarity) {
@@ -218,39 +1117,302 @@ inline void updateLearningState(PatternLearner& learner, float similarity) {
     }
 }
 
+// O(1): the current bar becomes the previous one and the oldest slot is reused lazily.
 inline void shiftBarsForNewBar(ChannelPattern& pattern) {
-    for (int i = 0; i < MAX_TICKS_PER_BAR; i++) {
-        pattern.hit_positions_bar2[i] = pattern.hit_positions_bar1[i];
-        pattern.hit_positions_bar1[i] = 0;
-    }
-    pattern.hit_count_bar2 = pattern.hit_count_bar1;
-    pattern.hit_count_bar1 = 0;
+    pattern.current_slot ^= 1;
+    pattern.stale_slots |= 1 << pattern.current_slot;
 }
 
-inline bool detectPatternChange(const ChannelPattern& learned, const ChannelPattern& incoming) {
+inline bool detectPatternChange(int learned_hits, int incoming_hits, int common_hits) {
     const float CHANGE_THRESHOLD = 90.0f;
-    
-    int matching_hits = 0;
-    int total_hits = 0;
-    
-    for (int i = 0; i < MAX_TICKS_PER_BAR; i++) {
-        bool learned_hit = learned.hit_positions_bar1[i] > 0;
-        bool incoming_hit = incoming.hit_positions_bar1[i] > 0;
-        
-        if (learned_hit && incoming_hit) {
-            matching_hits++;
+    return similarityFromCounts(learned_hits, incoming_hits, common_hits) < CHANGE_THRESHOLD;
+}
+
+// True once a bar in progress can no longer pass detectPatternChange, even if every learned
+// hit still ahead arrives and nothing else does. `missed_hits` counts learned hits whose tick
+// has gone by without an incoming hit.
+inline bool patternChangeInevitable(int learned_hits, int incoming_hits, int common_hits, int missed_hits) {
+    const int extra_hits = incoming_hits - common_hits;
+    const int best_common = learned_hits - missed_hits;
+    return detectPatternChange(learned_hits, best_common + extra_hits, best_common);
+}
+
+constexpr int FAST_LOCK_MIN_HITS = 4;  // confirmed hits needed before locking mid-bar
+
+// Partial-bar evidence for locking before the bar ends: so far the bar repeats the previous
+// one exactly (no extra hit, no missed hit) and has confirmed at least half of it. Sparse
+// grooves need FAST_LOCK_MIN_HITS, so ambiguous inputs still wait for the bar end.
+inline bool fastLockConfident(int previous_hits, int current_hits, int common_hits, int missed_hits) {
+    if (previous_hits == 0 || missed_hits > 0 || current_hits != common_hits) {
+        return false;
+    }
+    return common_hits >= FAST_LOCK_MIN_HITS && common_hits * 2 >= previous_hits;
+}
+
+// Ticks per 16th note on the internal grid, or 0 when 16ths are not coarser than a tick or
+// do not fall on ticks.
+inline int coarseCellTicks(int ppqn) {
+    return (ppqn >= 8 && ppqn % 4 == 0) ? ppqn / 4 : 0;
+}
+
+// Nearest coarse cell to a tick; the last half cell belongs to the next downbeat.
+inline int coarseCell(int tick, int cell_ticks, int num_cells) {
+    const int cell = (tick + cell_ticks / 2) / cell_ticks;
+    return (cell >= num_cells) ? 0 : cell;
+}
+
+// Quantize a bar onto a coarse grid, one bit per cell.
+inline void quantizeBar(const PatternBits& in, int limit, int cell_ticks, PatternBits& out) {
+    out.clear();
+    const int num_cells = limit / cell_ticks;
+    for (int i = findNextHit(in, 0, limit); i >= 0; i = findNextHit(in, i + 1, limit)) {
+        out.set(coarseCell(i, cell_ticks, num_cells));
+    }
+}
+
+// Similarity of two bars after quantizing both to `cell_ticks`, so swing and push/pull
+// within a 16th do not count as differences.
+inline float coarseSimilarity(const PatternBits& a, const PatternBits& b, int limit, int cell_ticks) {
+    PatternBits qa;
+    PatternBits qb;
+    quantizeBar(a, limit, cell_ticks, qa);
+    quantizeBar(b, limit, cell_ticks, qb);
+    return similarityFromCounts(countHits(qa), countHits(qb), countCommonHits(qa, qb));
+}
+
+// Offset between two ticks of a looping bar, taking the short way round.
+inline int wrappedOffset(int from, int to, int limit) {
+    int offset = to - from;
+    if (offset > limit / 2) offset -= limit;
+    if (offset < -limit / 2) offset += limit;
+    return offset;
+}
+
+// Start refining a coarse lock: each 16th holding exactly one learned hit is refinable.
+inline void beginRefinement(LearnRefinement& r, const PatternBits& learned, int limit, int cell_ticks) {
+    const int num_cells = limit / cell_ticks;
+    r = LearnRefinement();
+    for (int i = findNextHit(learned, 0, limit); i >= 0; i = findNextHit(learned, i + 1, limit)) {
+        const int cell = coarseCell(i, cell_ticks, num_cells);
+        r.samples[cell] = (r.samples[cell] == 0) ? 1 : 0xFF;
+    }
+    for (int cell = 0; cell < num_cells; cell++) {
+        if (r.samples[cell] == 0xFF) r.samples[cell] = 0;
+    }
+    r.bars_left = REFINE_BARS;
+}
+
+// Add one played bar: a 16th with a single hit pulls its learned hit towards it.
+inline void accumulateRefinement(LearnRefinement& r, const PatternBits& learned, const PatternBits& played,
+                                 int limit, int cell_ticks) {
+    const int num_cells = limit / cell_ticks;
+    uint32_t seen = 0;
+    uint32_t repeated = 0;
+    for (int i = findNextHit(played, 0, limit); i >= 0; i = findNextHit(played, i + 1, limit)) {
+        const uint32_t bit = 1u << coarseCell(i, cell_ticks, num_cells);
+        repeated |= seen & bit;
+        seen |= bit;
+    }
+    for (int i = findNextHit(learned, 0, limit); i >= 0; i = findNextHit(learned, i + 1, limit)) {
+        const int cell = coarseCell(i, cell_ticks, num_cells);
+        if (r.samples[cell] == 0 || r.samples[cell] == 0xFF || !(seen & (1u << cell)) || (repeated & (1u << cell))) {
+            continue;
         }
-        if (learned_hit || incoming_hit) {
-            total_hits++;
+        // The played hit of this cell: search the cell's span around the learned hit.
+        for (int d = -cell_ticks; d <= cell_ticks; d++) {
+            const int t = ((i + d) % limit + limit) % limit;
+            if (played.test(t) && coarseCell(t, cell_ticks, num_cells) == cell) {
+                r.offset_sum[cell] = (int16_t)(r.offset_sum[cell] + wrappedOffset(i, t, limit));
+                r.samples[cell]++;
+                break;
+            }
         }
     }
-    
-    if (total_hits == 0) {
-        return false;
+}
+
+// The learned bar with each refinable hit moved by its mean offset. Returns the hit count.
+inline uint16_t applyRefinement(const LearnRefinement& r, const PatternBits& learned, int limit, int cell_ticks,
+                                PatternBits& out) {
+    const int num_cells = limit / cell_ticks;
+    out.clear();
+    for (int i = findNextHit(learned, 0, limit); i >= 0; i = findNextHit(learned, i + 1, limit)) {
+        const int cell = coarseCell(i, cell_ticks, num_cells);
+        int pos = i;
+        const int n = r.samples[cell];
+        if (n > 1) {
+            const int sum = r.offset_sum[cell];
+            const int mean = (sum >= 0) ? (sum + n / 2) / n : -((-sum + n / 2) / n);
+            pos = ((i + mean) % limit + limit) % limit;
+        }
+        out.set(pos);
     }
-    
-    float similarity = (matching_hits * 100.0f) / total_hits;
-    return similarity < CHANGE_THRESHOLD;
+    return (uint16_t)countHits(out);
+}
+
+// FNV-1a hash of a bar's bits: equal bars always share a fingerprint.
+inline uint32_t patternFingerprint(const PatternBits& bits) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < PATTERN_WORDS; i++) {
+        hash = (hash ^ bits.words[i]) * 16777619u;
+    }
+    return hash;
+}
+
+inline bool sameBits(const PatternBits& a, const PatternBits& b) {
+    for (int i = 0; i < PATTERN_WORDS; i++) {
+        if (a.words[i] != b.words[i]) return false;
+    }
+    return true;
+}
+
+// Start the counters from a learned bar: its hits at HISTOGRAM_SEED, everything else at 0.
+inline void seedHistogram(HitHistogram& h, const PatternBits& learned) {
+    for (int k = 0; k < HISTOGRAM_PLANES; k++) {
+        for (int i = 0; i < PATTERN_WORDS; i++) {
+            h.planes[k].words[i] = ((HISTOGRAM_SEED >> k) & 1) ? learned.words[i] : 0u;
+        }
+    }
+    h.model = patternFingerprint(learned);
+}
+
+inline int histogramCount(const HitHistogram& h, int tick) {
+    int count = 0;
+    for (int k = 0; k < HISTOGRAM_PLANES; k++) {
+        count |= (int)h.planes[k].test(tick) << k;
+    }
+    return count;
+}
+
+// Move every counter one step: up where `up` is set, down everywhere else, saturating at 0
+// and HISTOGRAM_MAX. Ripple-carry (and -borrow) through the planes, 32 ticks at a time.
+inline void stepHistogram(HitHistogram& h, const PatternBits& up) {
+    for (int i = 0; i < PATTERN_WORDS; i++) {
+        uint32_t full = ~0u;
+        uint32_t nonzero = 0;
+        for (int k = 0; k < HISTOGRAM_PLANES; k++) {
+            full &= h.planes[k].words[i];
+            nonzero |= h.planes[k].words[i];
+        }
+        uint32_t carry = up.words[i] & ~full;
+        uint32_t borrow = ~up.words[i] & nonzero;
+        for (int k = 0; k < HISTOGRAM_PLANES; k++) {
+            const uint32_t plane = h.planes[k].words[i];
+            h.planes[k].words[i] = plane ^ carry ^ borrow;
+            carry &= plane;
+            borrow &= ~plane;
+        }
+    }
+}
+
+// Ticks whose counter is at least `threshold`, by a bit-sliced compare from the top plane.
+inline void thresholdHistogram(const HitHistogram& h, int threshold, PatternBits& out) {
+    for (int i = 0; i < PATTERN_WORDS; i++) {
+        uint32_t greater = 0;
+        uint32_t equal = ~0u;
+        for (int k = HISTOGRAM_PLANES - 1; k >= 0; k--) {
+            const uint32_t plane = h.planes[k].words[i];
+            if ((threshold >> k) & 1) {
+                equal &= plane;
+            } else {
+                greater |= equal & plane;
+                equal &= ~plane;
+            }
+        }
+        out.words[i] = greater | equal;
+    }
+}
+
+// Count one played bar: learned hits played within `tolerance` go up, as do played hits away
+// from every learned hit (`learned_window` is the learned bar dilated by the tolerance);
+// every other tick goes down. A one-off flam or ghost note fades out instead of staying.
+inline void updateHistogram(HitHistogram& h, const PatternBits& learned, const PatternBits& learned_window,
+                            const PatternBits& played, int limit, int tolerance) {
+    PatternBits near_played;
+    dilateBits(played, tolerance, limit, near_played);
+    PatternBits up;
+    for (int i = 0; i < PATTERN_WORDS; i++) {
+        up.words[i] = (learned.words[i] & near_played.words[i]) | (played.words[i] & ~learned_window.words[i]);
+    }
+    stepHistogram(h, up);
+}
+
+// Mark a cached groove as just used.
+inline void touchGroove(GrooveCache& cache, int index) {
+    cache.entries[index].last_used = ++cache.use_counter;
+}
+
+// Remember a groove: an identical one already cached is refreshed, otherwise it replaces an
+// empty entry or the least recently used one. Returns the entry index.
+inline int rememberGroove(GrooveCache& cache, const PatternBits& bits, uint16_t hit_count, int ppqn,
+                          int ticks_per_bar, bool coarse) {
+    const uint32_t fingerprint = patternFingerprint(bits);
+    int slot = 0;
+    for (int i = 0; i < GROOVE_CACHE_SIZE; i++) {
+        const KnownGroove& e = cache.entries[i];
+        if (e.last_used != 0 && e.fingerprint == fingerprint && e.ppqn == ppqn &&
+            e.ticks_per_bar == ticks_per_bar && sameBits(e.bits, bits)) {
+            slot = i;
+            break;
+        }
+        if (e.last_used < cache.entries[slot].last_used) {
+            slot = i;
+        }
+    }
+    KnownGroove& e = cache.entries[slot];
+    e.bits = bits;
+    e.fingerprint = fingerprint;
+    e.hit_count = hit_count;
+    e.ppqn = (uint16_t)ppqn;
+    e.ticks_per_bar = (uint16_t)ticks_per_bar;
+    e.coarse = coarse;
+    touchGroove(cache, slot);
+    return slot;
+}
+
+// Empty a history from an older epoch, like syncPattern.
+inline BarHistory& syncHistory(BarHistory& history, uint32_t epoch) {
+    if (history.epoch != epoch) {
+        history.epoch = epoch;
+        history.head = 0;
+        history.count = 0;
+    }
+    return history;
+}
+
+inline void pushHistory(BarHistory& history, const PatternBits& bar, uint16_t hit_count) {
+    history.head = (uint8_t)((history.head + 1) % MAX_PHRASE_BARS);
+    history.bars[history.head] = bar;
+    history.hit_counts[history.head] = hit_count;
+    if (history.count < MAX_PHRASE_BARS) history.count++;
+}
+
+// Slot of the bar completed `bars_ago` bars before the newest one plus one (1 = newest);
+// -1 when the history does not reach that far back.
+inline int historySlot(const BarHistory& history, int bars_ago) {
+    if (bars_ago < 1 || bars_ago > history.count) return -1;
+    return (history.head + MAX_PHRASE_BARS + 1 - bars_ago) % MAX_PHRASE_BARS;
+}
+
+// Matching bars needed before a phrase of `period` bars locks: a whole period of them, so
+// every bar of the phrase has been played twice, and at least the Learn Bars setting.
+inline int phraseMatchesNeeded(int period, int required_stable_bars) {
+    return period > required_stable_bars ? period : required_stable_bars;
+}
+
+// Shortest phrase whose detector has seen enough consecutive matches, 0 for none.
+inline int detectedPhrase(const uint8_t* matches, int required_stable_bars) {
+    for (int k = 0; k < PHRASE_PERIODS; k++) {
+        if (matches[k] >= phraseMatchesNeeded(phrasePeriod(k), required_stable_bars)) {
+            return phrasePeriod(k);
+        }
+    }
+    return 0;
+}
+
+// Full comparison; the step callback uses the counts recorded against the learned bar instead.
+inline bool detectPatternChange(const ChannelPattern& learned, const ChannelPattern& incoming) {
+    return detectPatternChange(recordedHitCount(learned, 0), recordedHitCount(incoming, 0),
+                               countCommonHits(recordedBar(learned, 0), recordedBar(incoming, 0)));
 }
 
 inline void handlePatternChange(PatternLearner& learner) {
@@ -290,74 +1452,76 @@ inline bool shouldApplyInjection(uint8_t probability, uint8_t fuel, XorShift32&
     return random_value < scaled_probability;
 }
 
-inline void selectHitsForOmission(ChannelPattern* pattern, uint8_t* omit_indices, uint8_t* omit_count, uint8_t fuel, XorShift32* rng, uint16_t pattern_length) {
-    *omit_count = 0;
-    
-    uint8_t hit_count = 0;
-    uint16_t hit_positions[MAX_TICKS_PER_BAR];
-    uint16_t non_downbeat_positions[MAX_TICKS_PER_BAR];
-    uint8_t non_downbeat_count = 0;
-    
-    for (int i = 0; i < pattern_length; i++) {
-        if (pattern->hit_positions_bar1[i] > 0) {
-            hit_positions[hit_count++] = i;
-            if (i != 0) {
-                non_downbeat_positions[non_downbeat_count++] = i;
-            }
+// Index the hits of `bar` below `ticks_per_bar`. With ppqn 0 no beats are listed.
+inline void buildHitIndex(HitIndex& index, const PatternBits& bar, int ticks_per_bar, int ppqn) {
+    index.bar = bar;
+    index.ticks_per_bar = (uint16_t)ticks_per_bar;
+    index.ppqn = (uint16_t)ppqn;
+    index.count = 0;
+    index.beat_count = 0;
+    for (int i = findNextHit(bar, 0, ticks_per_bar); i >= 0; i = findNextHit(bar, i + 1, ticks_per_bar)) {
+        index.positions[index.count++] = (uint16_t)i;
+        if (ppqn > 0 && i % ppqn == 0 && index.beat_count < MAX_BAR_QUARTERS) {
+            index.beats[index.beat_count++] = (uint8_t)(i / ppqn);
         }
     }
-    
-    if (hit_count == 0) {
+}
+
+// True when `index` was built from this bar on this grid and can be used as it is.
+inline bool hitIndexCurrent(const HitIndex& index, const PatternBits& bar, int ticks_per_bar, int ppqn) {
+    return index.ticks_per_bar == ticks_per_bar && index.ppqn == ppqn && sameBits(index.bar, bar);
+}
+
+// Picks up to a quarter of the hits to drop, sparing the downbeat unless it is the only hit,
+// and calls `omit(tick)` for each.
+template <typename Visit>
+inline void forEachOmittedHit(const HitIndex& index, uint8_t fuel, XorShift32* rng, Visit omit) {
+    if (index.count == 0) {
         return;
     }
     
-    uint8_t max_omissions = (hit_count + 3) / 4;
-    if (max_omissions == 0) {
-        return;
-    }
+    const int max_omissions = (index.count + 3) / 4;
     
-    uint16_t* candidate_pool = non_downbeat_count > 0 ? non_downbeat_positions : hit_positions;
-    uint8_t pool_size = non_downbeat_count > 0 ? non_downbeat_count : hit_count;
+    // The downbeat can only be first in the list.
+    const int skip = (index.count > 1 && index.positions[0] == 0) ? 1 : 0;
+    const uint16_t* candidate_pool = index.positions + skip;
+    int pool_size = index.count - skip;
     
-    for (uint8_t i = 0; i < max_omissions && i < pool_size; i++) {
+    // Picked candidates are marked rather than removed, so the index stays untouched; the
+    // n-th unmarked candidate is the one the removal would have left at position n.
+    PatternBits taken;
+    taken.clear();
+    
+    for (int i = 0; i < max_omissions && i < pool_size; i++) {
         if (shouldApplyInjection(100, fuel, *rng)) {
-            uint8_t random_index = rng->next() % pool_size;
-            omit_indices[*omit_count] = candidate_pool[random_index];
-            (*omit_count)++;
-            
-            for (uint8_t j = random_index; j < pool_size - 1; j++) {
-                candidate_pool[j] = candidate_pool[j + 1];
+            int remaining = rng->next() % pool_size;
+            int j = 0;
+            while (taken.test(j) || remaining-- > 0) {
+                j++;
             }
+            taken.set(j);
+            omit(candidate_pool[j]);
             pool_size--;
         }
     }
 }
 
-inline void applyOmissionInjection(bool* output_pattern, uint8_t* omit_indices, uint8_t omit_count) {
-    for (uint8_t i = 0; i < omit_count; i++) {
-        output_pattern[omit_indices[i]] = false;
-    }
+inline void selectHitsForOmission(const HitIndex& index, uint16_t* omit_indices, uint16_t* omit_count, uint8_t fuel, XorShift32* rng) {
+    *omit_count = 0;
+    forEachOmittedHit(index, fuel, rng, [&](uint16_t tick) { omit_indices[(*omit_count)++] = tick; });
 }
 
-inline void selectHitsForRoll(ChannelPattern* pattern, uint8_t* roll_indices, uint8_t* roll_count, uint8_t* roll_subdivisions, uint8_t fuel, XorShift32* rng, uint16_t pattern_length) {
-    *roll_count = 0;
-    
-    uint8_t hit_count = 0;
-    uint16_t hit_positions[MAX_TICKS_PER_BAR];
-    
-    for (int i = 0; i < pattern_length; i++) {
-        if (pattern->hit_positions_bar1[i] > 0) {
-            hit_positions[hit_count++] = i;
-        }
-    }
-    
-    if (hit_count == 0) {
-        return;
+inline void applyOmissionInjection(PatternBits* output_pattern, const uint16_t* omit_indices, uint16_t omit_count) {
+    for (uint16_t i = 0; i < omit_count; i++) {
+        output_pattern->reset(omit_indices[i]);
     }
+}
 
-    for (uint8_t i = 0; i < hit_count; i++) {
+// Picks hits to roll and calls `roll(tick, subdivisions)` for each.
+template <typename Visit>
+inline void forEachRolledHit(const HitIndex& index, uint8_t fuel, XorShift32* rng, Visit roll) {
+    for (int i = 0; i < index.count; i++) {
         if (shouldApplyInjection(100, fuel, *rng)) {
-            roll_indices[*roll_count] = hit_positions[i];
             // Scale roll intensity with fuel/strength:
             // - low: mostly doubles
             // - mid: doubles + some triplets
@@ -380,62 +1544,85 @@ inline void selectHitsForRoll(ChannelPattern* pattern, uint8_t* roll_indices, ui
                     subdivision = 2;
                 }
             }
-            roll_subdivisions[*roll_count] = subdivision;
-            (*roll_count)++;
+            roll(index.positions[i], subdivision);
         }
     }
 }
 
-inline void applyRollInjection(bool* output_pattern, uint8_t* roll_indices, uint8_t roll_count, uint8_t* roll_subdivisions, uint16_t ppqn) {
-    for (uint8_t i = 0; i < roll_count; i++) {
-        uint16_t original_position = roll_indices[i];
-        uint8_t subdivisions = roll_subdivisions[i];
-        uint16_t spacing = ppqn / subdivisions;
-        
-        uint16_t beat_start = (original_position / ppqn) * ppqn;
-        uint16_t beat_end = beat_start + ppqn;
-        
-        for (uint8_t j = 1; j < subdivisions; j++) {
-            uint16_t new_position = original_position + (spacing * j);
-            if (new_position < beat_end && new_position < MAX_TICKS_PER_BAR) {
-                output_pattern[new_position] = true;
-            }
-        }
-    }
+inline void selectHitsForRoll(const HitIndex& index, uint16_t* roll_indices, uint16_t* roll_count, uint8_t* roll_subdivisions, uint8_t fuel, XorShift32* rng) {
+    *roll_count = 0;
+    forEachRolledHit(index, fuel, rng, [&](uint16_t tick, uint8_t subdivisions) {
+        roll_indices[*roll_count] = tick;
+        roll_subdivisions[*roll_count] = subdivisions;
+        (*roll_count)++;
+    });
 }
 
-inline void selectBeatsForDensityBurst(ChannelPattern* pattern, uint8_t* burst_beat_indices, uint8_t* burst_count, uint8_t fuel, XorShift32* rng, uint16_t pattern_length, uint16_t ppqn) {
-    *burst_count = 0;
+// Add the repeats of one rolled hit. With an off-grid list, subdivisions that do not divide
+// the beat evenly are placed at exact sub-tick positions instead of being rounded down to
+// whole ticks.
+inline void applyRoll(PatternBits* output_pattern, uint16_t original_position, uint8_t subdivisions, uint16_t ppqn,
+                      OffGridHits* off_grid = nullptr) {
+    uint16_t spacing = ppqn / subdivisions;
     
-    uint8_t beat_count = 0;
-    uint8_t beat_indices[MAX_TICKS_PER_BAR / 48];
+    uint16_t beat_start = (original_position / ppqn) * ppqn;
+    uint16_t beat_end = beat_start + ppqn;
     
-    for (int i = 0; i < pattern_length; i += ppqn) {
-        if (pattern->hit_positions_bar1[i] > 0) {
-            beat_indices[beat_count++] = i / ppqn;
+    if (off_grid && (ppqn % subdivisions) != 0) {
+        const uint32_t fine_spacing = (uint32_t)ppqn * SUBTICKS_PER_TICK / subdivisions;
+        const uint32_t fine_end = (uint32_t)(beat_end < MAX_TICKS_PER_BAR ? beat_end : MAX_TICKS_PER_BAR) * SUBTICKS_PER_TICK;
+        for (uint8_t j = 1; j < subdivisions; j++) {
+            const uint32_t position = (uint32_t)original_position * SUBTICKS_PER_TICK + fine_spacing * j;
+            if (position < fine_end) {
+                placeFineHit(output_pattern, off_grid, position);
+            }
         }
+        return;
     }
     
-    if (beat_count == 0) {
-        return;
+    for (uint8_t j = 1; j < subdivisions; j++) {
+        uint16_t new_position = original_position + (spacing * j);
+        if (new_position < beat_end && new_position < MAX_TICKS_PER_BAR) {
+            output_pattern->set(new_position);
+        }
     }
+}
+
+inline void applyRollInjection(PatternBits* output_pattern, const uint16_t* roll_indices, uint16_t roll_count,
+                               const uint8_t* roll_subdivisions, uint16_t ppqn, OffGridHits* off_grid = nullptr) {
+    for (uint16_t i = 0; i < roll_count; i++) {
+        applyRoll(output_pattern, roll_indices[i], roll_subdivisions[i], ppqn, off_grid);
+    }
+}
+
+inline void selectBeatsForDensityBurst(const HitIndex& index, uint8_t* burst_beat_indices, uint8_t* burst_count, uint8_t fuel, XorShift32* rng) {
+    *burst_count = 0;
     
-    for (uint8_t i = 0; i < beat_count; i++) {
+    for (uint8_t i = 0; i < index.beat_count; i++) {
         if (shouldApplyInjection(100, fuel, *rng)) {
-            burst_beat_indices[*burst_count] = beat_indices[i];
+            burst_beat_indices[*burst_count] = index.beats[i];
             (*burst_count)++;
         }
     }
 }
 
-inline void applyDensityBurstInjection(bool* output_pattern, uint8_t* burst_beat_indices, uint8_t burst_count, uint16_t ppqn) {
+// With an off-grid list, odd PPQN places the offbeat exactly halfway through the beat.
+inline void applyDensityBurstInjection(PatternBits* output_pattern, uint8_t* burst_beat_indices, uint8_t burst_count, uint16_t ppqn,
+                                       OffGridHits* off_grid = nullptr) {
     for (uint8_t i = 0; i < burst_count; i++) {
         uint16_t beat_start = burst_beat_indices[i] * ppqn;
+        if (off_grid && (ppqn % 2) != 0) {
+            if (beat_start + ppqn <= MAX_TICKS_PER_BAR) {
+                placeFineHit(output_pattern, off_grid,
+                             (uint32_t)beat_start * SUBTICKS_PER_TICK + (uint32_t)ppqn * SUBTICKS_PER_TICK / 2);
+            }
+            continue;
+        }
         uint16_t eighth_note_offset = ppqn / 2;
         uint16_t subdivision_pos = beat_start + eighth_note_offset;
         
         if (subdivision_pos < MAX_TICKS_PER_BAR) {
-            output_pattern[subdivision_pos] = true;
+            output_pattern->set(subdivision_pos);
         }
     }
 }
@@ -503,7 +1690,7 @@ inline void generatePermutation(uint8_t* permutation, uint8_t segment_count, Xor
     }
 }
 
-inline void applyPermutationInjection(bool* input_pattern, bool* output_pattern, uint8_t* permutation, uint16_t ppqn, uint16_t pattern_length) {
+inline void applyPermutationInjection(const PatternBits* input_pattern, PatternBits* output_pattern, uint8_t* permutation, uint16_t ppqn, uint16_t pattern_length) {
     if (!input_pattern || !output_pattern || !permutation || pattern_length == 0) {
         return;
     }
@@ -512,17 +1699,13 @@ inline void applyPermutationInjection(bool* input_pattern, bool* output_pattern,
     // fall back to an identity copy rather than producing silence or dividing by zero.
     const uint16_t eighth_note_ticks = (ppqn >= 2) ? (ppqn / 2) : 0;
     if (eighth_note_ticks == 0) {
-        for (uint16_t i = 0; i < pattern_length; i++) {
-            output_pattern[i] = input_pattern[i];
-        }
+        *output_pattern = *input_pattern;
         return;
     }
 
     const uint8_t segment_count = (uint8_t)(pattern_length / eighth_note_ticks);
 
-    for (uint16_t i = 0; i < pattern_length; i++) {
-        output_pattern[i] = false;
-    }
+    output_pattern->clear();
 
     for (uint8_t dst_segment = 0; dst_segment < segment_count; dst_segment++) {
         uint8_t src_segment = permutation[dst_segment];
@@ -535,11 +1718,36 @@ inline void applyPermutationInjection(bool* input_pattern, bool* output_pattern,
         for (uint16_t j = 0; j < eighth_note_ticks; j++) {
             const uint16_t src_pos = src_start + j;
             const uint16_t dst_pos = dst_start + j;
-            if (src_pos < pattern_length && dst_pos < pattern_length) {
-                output_pattern[dst_pos] = input_pattern[src_pos];
+            if (src_pos < pattern_length && dst_pos < pattern_length && input_pattern->test(src_pos)) {
+                output_pattern->set(dst_pos);
+            }
+        }
+    }
+}
+
+// Apply the same eighth-note segment permutation to off-grid hits; hits past the last whole
+// segment are dropped, matching applyPermutationInjection.
+inline void permuteOffGridHits(OffGridHits* off_grid, const uint8_t* permutation, uint16_t ppqn, uint16_t pattern_length) {
+    const uint16_t eighth_note_ticks = (ppqn >= 2) ? (ppqn / 2) : 0;
+    if (!off_grid || !permutation || eighth_note_ticks == 0) {
+        return;
+    }
+    const uint8_t segment_count = (uint8_t)(pattern_length / eighth_note_ticks);
+    const uint32_t segment_length = (uint32_t)eighth_note_ticks * SUBTICKS_PER_TICK;
+
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < off_grid->count; i++) {
+        const uint32_t position = off_grid->positions[i];
+        const uint32_t src_segment = position / segment_length;
+        for (uint8_t dst_segment = 0; dst_segment < segment_count; dst_segment++) {
+            const uint8_t src = (permutation[dst_segment] < segment_count) ? permutation[dst_segment] : dst_segment;
+            if (src == src_segment) {
+                off_grid->positions[kept++] = dst_segment * segment_length + position % segment_length;
+                break;
             }
         }
     }
+    off_grid->count = kept;
 }
 
 inline uint8_t selectPolyrhythmType(XorShift32* rng) {
@@ -548,14 +1756,14 @@ inline uint8_t selectPolyrhythmType(XorShift32* rng) {
     return types[index];
 }
 
-inline void applyPolyrhythmInjection(bool* output_pattern, uint8_t polyrhythm_type, uint16_t ppqn, uint16_t bar_length_qn) {
+inline void applyPolyrhythmInjection(PatternBits* output_pattern, uint8_t polyrhythm_type, uint16_t ppqn, uint16_t bar_length_qn) {
     uint16_t bar_length_ticks = ppqn * bar_length_qn;
     uint16_t spacing = bar_length_ticks / polyrhythm_type;
     
     for (uint8_t i = 0; i < polyrhythm_type; i++) {
         uint16_t position = i * spacing;
         if (position < MAX_TICKS_PER_BAR) {
-            output_pattern[position] = true;
+            output_pattern->set(position);
         }
     }
 }
@@ -567,12 +1775,66 @@ inline bool shouldInjectThisBar(uint32_t bar_counter, uint8_t injection_interval
     return (bar_counter % injection_interval) == 0;
 }
 
+// Pick a ready variation slot at random, never the one played last.
+// Returns -1 when nothing else is ready.
+inline int pickVariation(uint8_t ready_mask, int last, uint32_t random) {
+    uint32_t candidates = ready_mask & ((1u << VARIATION_BANK_SIZE) - 1);
+    if (last >= 0) {
+        candidates &= ~(1u << last);
+    }
+    if (candidates == 0) {
+        return -1;
+    }
+    int n = (int)(random % (uint32_t)popcount32(candidates));
+    for (int slot = 0; slot < VARIATION_BANK_SIZE; ++slot) {
+        if ((candidates & (1u << slot)) && n-- == 0) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
 inline bool isBarComplete(uint16_t current_bar_position, uint16_t bar_length_ticks) {
     return current_bar_position >= (bar_length_ticks - 1);
 }
 
+// Most advanced state over the given channels, for display.
+inline FuelInjectorState summariseChannelStates(const uint8_t* channel_state, int num_channels) {
+    FuelInjectorState summary = LEARNING;
+    for (int c = 0; c < num_channels; c++) {
+        if (channel_state[c] == INJECTING) {
+            return INJECTING;
+        }
+        if (channel_state[c] == LOCKED) {
+            summary = LOCKED;
+        }
+    }
+    return summary;
+}
+
+// Channel c's state machine is the one of the first channel sharing its group (0 = own).
+inline void resolveGroupLeaders(const uint8_t* groups, int num_channels, uint8_t* leaders) {
+    for (int c = 0; c < num_channels; c++) {
+        leaders[c] = (uint8_t)c;
+        if (groups[c] == 0) {
+            continue;
+        }
+        for (int l = 0; l < c; l++) {
+            if (groups[l] == groups[c]) {
+                leaders[c] = (uint8_t)l;
+                break;
+            }
+        }
+    }
+}
+
 inline void handleReset(_FuelInjector_DTC* dtc, PatternLearner* learner) {
     dtc->state = LEARNING;
+    for (int c = 0; c < MAX_CHANNELS; c++) {
+        dtc->channel_state[c] = LEARNING;
+        dtc->stable_bars_count[c] = 0;
+    }
+    dtc->pattern_epoch++;
     dtc->bar_counter = 0;
     dtc->current_bar_position = 0;
     dtc->is_injection_bar = false;
@@ -77,3 +77,82 @@ TEST_CASE("Pattern change detection - state transition", "[change_detection]") {
         REQUIRE(learner.stable_bars_count == 0);
     }
 }
+
+TEST_CASE("Pattern change detection - from running counts", "[change_detection]") {
+    SECTION("Matches the full comparison") {
+        ChannelPattern learned = {};
+        ChannelPattern incoming = {};
+        for (int i = 0; i < 10; i++) {
+            recordHit(learned, 0, i * 10);
+        }
+        for (int i = 0; i < 9; i++) {
+            recordHit(incoming, 0, i * 10, &recordedBar(learned, 0));
+        }
+        REQUIRE(recordedReferenceHits(incoming) == 9);
+        REQUIRE(detectPatternChange(10, 9, recordedReferenceHits(incoming)) == detectPatternChange(learned, incoming));
+        recordHit(incoming, 0, 5, &recordedBar(learned, 0));
+        REQUIRE(detectPatternChange(10, 10, recordedReferenceHits(incoming)) == detectPatternChange(learned, incoming));
+        REQUIRE(detectPatternChange(10, 10, recordedReferenceHits(incoming)) == true);
+    }
+    
+    SECTION("Two empty bars are not a change") {
+        REQUIRE_FALSE(detectPatternChange(0, 0, 0));
+    }
+}
+
+TEST_CASE("Pattern change detection - mid-bar bound", "[change_detection]") {
+    SECTION("Bar that can still match is not given up") {
+        // 10 learned hits, 3 matched so far, nothing missed or extra.
+        REQUIRE_FALSE(patternChangeInevitable(10, 3, 3, 0));
+        REQUIRE_FALSE(patternChangeInevitable(10, 0, 0, 0));
+    }
+    
+    SECTION("One unexpected hit on a sparse pattern is enough") {
+        REQUIRE(patternChangeInevitable(4, 2, 1, 0));
+    }
+    
+    SECTION("Missed learned hits add up") {
+        REQUIRE_FALSE(patternChangeInevitable(10, 5, 5, 1));
+        REQUIRE(patternChangeInevitable(10, 5, 5, 2));
+    }
+    
+    SECTION("Never fires earlier than the bar-end check would") {
+        for (int extra = 0; extra < 4; extra++) {
+            for (int missed = 0; missed < 4; missed++) {
+                if (patternChangeInevitable(10, 4 + extra, 4, missed)) {
+                    // Best case for the rest of the bar: every remaining learned hit arrives.
+                    REQUIRE(detectPatternChange(10, 10 - missed + extra, 10 - missed));
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("Pattern change detection - timing tolerance", "[change_detection]") {
+    const int limit = 96;
+    PatternBits learned = {};
+    for (int beat = 0; beat < 4; beat++) {
+        learned.set(beat * 24);
+        learned.set(beat * 24 + 12);
+    }
+    PatternBits window;
+    dilateBits(learned, 2, limit, window);
+    
+    SECTION("Jittered hits count as expected against the learned window") {
+        ChannelPattern incoming = {};
+        for (int i = findNextHit(learned, 0, limit); i >= 0; i = findNextHit(learned, i + 1, limit)) {
+            recordHit(incoming, 0, (i + ((i / 12) % 3) - 1 + limit) % limit, &window);
+        }
+        REQUIRE(recordedReferenceHits(incoming) == recordedHitCount(incoming, 0));
+        REQUIRE_FALSE(patternChangeInevitable(countHits(learned), recordedHitCount(incoming, 0),
+                                              recordedReferenceHits(incoming), 0));
+        REQUIRE(toleranceSimilarity(learned, recordedBar(incoming, 0), limit, 2) >= 90.0f);
+    }
+    
+    SECTION("A hit outside every window is still a change") {
+        ChannelPattern incoming = {};
+        recordHit(incoming, 0, 6, &window);
+        REQUIRE(recordedReferenceHits(incoming) == 0);
+        REQUIRE(patternChangeInevitable(countHits(learned), 1, 0, 0));
+    }
+}
@@ -71,3 +71,217 @@ TEST_CASE("CV Clock timeout detection", "[cv_clock]") {
         REQUIRE(isClockTimeout(100000, TIMEOUT_SAMPLES) == true);
     }
 }
+
+TEST_CASE("Clock tracker - internal grid", "[cv_clock]") {
+    ClockTracker clock;
+    resetClockTracker(clock, 4);
+    uint32_t elapsed = 0;
+    
+    SECTION("Nothing is scheduled until the period is measured") {
+        REQUIRE(clockTrackerEdge(clock, elapsed) == 1);
+        REQUIRE(nextInternalTickDue(clock) == UINT32_MAX);
+        
+        elapsed = 1000;
+        REQUIRE(clockTrackerEdge(clock, elapsed) == 4);  // first pulse subdivided late
+        REQUIRE(elapsed == 0);
+        REQUIRE((clock.period_q8 >> 8) == 1000);
+        REQUIRE(internalTickPeriod(clock) == 250);
+    }
+    
+    SECTION("Internal ticks are spaced evenly across the pulse") {
+        clockTrackerEdge(clock, elapsed);
+        elapsed = 1000;
+        clockTrackerEdge(clock, elapsed);
+        
+        REQUIRE(nextInternalTickDue(clock) == 250);
+        clockTrackerAdvance(clock, elapsed);
+        REQUIRE(nextInternalTickDue(clock) == 500);
+        clockTrackerAdvance(clock, elapsed);
+        REQUIRE(nextInternalTickDue(clock) == 750);
+        clockTrackerAdvance(clock, elapsed);
+        
+        elapsed = 1000;
+        REQUIRE(clockTrackerEdge(clock, elapsed) == 1);
+    }
+    
+    SECTION("An early edge emits the ticks still owed") {
+        clockTrackerEdge(clock, elapsed);
+        elapsed = 1000;
+        clockTrackerEdge(clock, elapsed);
+        clockTrackerAdvance(clock, elapsed);
+        
+        elapsed = 600;
+        REQUIRE(clockTrackerEdge(clock, elapsed) == 3);
+    }
+}
+
+TEST_CASE("Clock tracker - jitter and flywheel", "[cv_clock]") {
+    ClockTracker clock;
+    resetClockTracker(clock, 1);
+    uint32_t elapsed = 0;
+    clockTrackerEdge(clock, elapsed);
+    elapsed = 1000;
+    clockTrackerEdge(clock, elapsed);
+    
+    SECTION("Jitter is averaged, tempo jumps are followed") {
+        REQUIRE(smoothClockPeriod(1000 << 8, 1040) == (1005u << 8));
+        REQUIRE(smoothClockPeriod(1000 << 8, 1500) == (1500u << 8));
+    }
+    
+    SECTION("A single missing edge is bridged at the predicted time") {
+        REQUIRE(nextInternalTickDue(clock) == 1000);
+        elapsed = 1010;
+        clockTrackerAdvance(clock, elapsed);
+        REQUIRE(elapsed == 10);
+        REQUIRE(clock.missed_edges == 1);
+        REQUIRE(nextInternalTickDue(clock) == UINT32_MAX);  // no second flywheel edge
+        
+        elapsed = 1000;
+        REQUIRE(clockTrackerEdge(clock, elapsed) == 1);
+        REQUIRE(clock.missed_edges == 0);
+    }
+    
+    SECTION("An edge just after the flywheel edge only re-phases") {
+        elapsed = 1000;
+        clockTrackerAdvance(clock, elapsed);
+        elapsed = 20;
+        REQUIRE(clockTrackerEdge(clock, elapsed) == 0);
+        REQUIRE(elapsed == 0);
+        REQUIRE(clock.missed_edges == 0);
+        REQUIRE((clock.period_q8 >> 8) == 1002);
+    }
+}
+
+TEST_CASE("Clock multiplier fits the internal grid", "[cv_clock]") {
+    REQUIRE(effectiveClockMultiplier(4, 12, 4) == 12);
+    REQUIRE(effectiveClockMultiplier(4, 48, 4) == 12);
+    REQUIRE(effectiveClockMultiplier(48, 2, 4) == 1);
+    REQUIRE(effectiveClockMultiplier(24, 2, 8) == 1);   // 384 ticks would not fit a bar
+    REQUIRE(effectiveClockMultiplier(1, 0, 4) == 1);
+}
+
+TEST_CASE("Clock tracker - stop and resume", "[cv_clock]") {
+    ClockTracker clock;
+    resetClockTracker(clock, 2);
+    uint32_t elapsed = 0;
+    clockTrackerEdge(clock, elapsed);
+    elapsed = 1000;
+    clockTrackerEdge(clock, elapsed);
+    
+    // Run out the pulse and let the flywheel bridge the next edge.
+    elapsed = 500;
+    clockTrackerAdvance(clock, elapsed);
+    elapsed = 1000;
+    clockTrackerAdvance(clock, elapsed);
+    REQUIRE(clock.missed_edges == 1);
+    elapsed = 500;
+    clockTrackerAdvance(clock, elapsed);
+    
+    SECTION("Stopped only after the flywheel and a further half period") {
+        REQUIRE(isClockStopped(clock, 1499) == false);
+        REQUIRE(isClockStopped(clock, 1500) == true);
+        
+        ClockTracker fresh;
+        resetClockTracker(fresh, 2);
+        REQUIRE(isClockStopped(fresh, 1000000) == false);
+    }
+    
+    SECTION("Nothing is scheduled while stopped") {
+        clock.stopped = true;
+        REQUIRE(nextInternalTickDue(clock) == UINT32_MAX);
+    }
+    
+    SECTION("Resuming edge was already emitted by the flywheel") {
+        clock.stopped = true;
+        elapsed = 96000;
+        REQUIRE(clockTrackerEdge(clock, elapsed) == 0);
+        REQUIRE(clock.stopped == false);
+        REQUIRE((clock.period_q8 >> 8) == 1000);  // the pause is not a tempo
+        
+        elapsed = 1000;
+        REQUIRE(clockTrackerEdge(clock, elapsed) == 1);
+    }
+    
+    SECTION("After a restart the first edge is a fresh tick 0") {
+        clock.stopped = true;
+        clockTrackerRestart(clock);
+        elapsed = 96000;
+        REQUIRE(clockTrackerEdge(clock, elapsed) == 1);
+        REQUIRE((clock.period_q8 >> 8) == 1000);
+        REQUIRE(nextInternalTickDue(clock) == 500);
+    }
+}
+
+TEST_CASE("Auto grid - input period and bar", "[cv_clock]") {
+    static const int ppqnOptions[] = { 1, 2, 4, 8, 16, 24, 48 };
+    const int numPpqn = 7;
+    OnsetHistory onsets = {};
+    
+    SECTION("Hits are kept per pulse, a rounded-up one until its pulse") {
+        onsetAdvance(onsets);
+        onsetRecord(onsets, false);
+        onsetRecord(onsets, true);
+        onsetAdvance(onsets);
+        onsetAdvance(onsets);
+        uint32_t window[ONSET_HISTORY_WORDS];
+        REQUIRE(onsetWindow(onsets, window) == 3);
+        REQUIRE(window[0] == 0x6u);   // pulses 1 and 2
+    }
+    
+    SECTION("A groove repeating every 20 pulses has a period of 20") {
+        const int groove[] = { 0, 3, 8, 12, 15 };
+        for (int pulse = 0; pulse < 100; pulse++) {
+            onsetAdvance(onsets);
+            for (int g : groove) {
+                if (pulse % 20 == g) onsetRecord(onsets, false);
+            }
+        }
+        uint32_t window[ONSET_HISTORY_WORDS];
+        const int count = onsetWindow(onsets, window);
+        REQUIRE(repeatPeriod(window, count, MAX_TICKS_PER_BAR, 90.0f) == 20);
+        // Not before two repeats are held.
+        REQUIRE(repeatPeriod(window, 39, MAX_TICKS_PER_BAR, 90.0f) == 0);
+    }
+    
+    SECTION("Lagged matches straddle word boundaries") {
+        uint32_t bits[ONSET_HISTORY_WORDS] = {};
+        bits[0] = 1u << 30;
+        bits[1] = 1u << 5;   // bit 37, 7 after bit 30
+        REQUIRE(countLagMatches(bits, 64, 7) == 1);
+        REQUIRE(countLagMatches(bits, 64, 6) == 0);
+        REQUIRE(countLagMatches(bits, 37, 7) == 0);
+        REQUIRE(bitsFrom(bits, -2) == (bits[0] << 2));
+        REQUIRE(countBitsFrom(bits, 31, 64) == 1);
+    }
+    
+    SECTION("Too few hits give no period") {
+        uint32_t bits[ONSET_HISTORY_WORDS] = {};
+        bits[0] = 0x01010101u;
+        REQUIRE(repeatPeriod(bits, 64, MAX_TICKS_PER_BAR, 90.0f) == 0);
+    }
+    
+    SECTION("The fitting bar closest to the current one wins") {
+        int ppqnIndex = -1;
+        int barLength = 0;
+        // 5/4 at 4 PPQN while set to 4/4.
+        REQUIRE(nearestBarGrid(20, 0, 16, ppqnOptions, numPpqn, 2, ppqnIndex, barLength));
+        REQUIRE(ppqnIndex == 2);
+        REQUIRE(barLength == 5);
+        // A 3/4 groove at 24 PPQN while set to 4/4.
+        REQUIRE(nearestBarGrid(72, 0, 96, ppqnOptions, numPpqn, 5, ppqnIndex, barLength));
+        REQUIRE(ppqnIndex == 5);
+        REQUIRE(barLength == 3);
+    }
+    
+    SECTION("A bar must divide the reset span") {
+        int ppqnIndex = -1;
+        int barLength = 0;
+        // Resets 16 pulses apart with 24 PPQN set: no 24 PPQN bar fits, a 4 PPQN 4/4 bar does.
+        REQUIRE(nearestBarGrid(1, 16, 96, ppqnOptions, numPpqn, 5, ppqnIndex, barLength));
+        REQUIRE(ppqnOptions[ppqnIndex] * barLength == 16);
+        REQUIRE(barLength == 4);
+        // A span only single pulses divide is no bar.
+        REQUIRE_FALSE(nearestBarGrid(1, 337, 96, ppqnOptions, numPpqn, 5, ppqnIndex, barLength));
+        REQUIRE_FALSE(nearestBarGrid(7, 16, 96, ppqnOptions, numPpqn, 5, ppqnIndex, barLength));
+    }
+}
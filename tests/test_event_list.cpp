@@ -0,0 +1,152 @@
+#include "catch.hpp"
+#include "../fuel_injector.h"
+
+TEST_CASE("Event list - compile from bitset", "[event_list]") {
+    PatternBits bits = {};
+    EventList list = {};
+    
+    SECTION("Events are sorted at full level with no offset") {
+        bits.set(96);
+        bits.set(0);
+        bits.set(48);
+        
+        REQUIRE(compileEvents(bits, 192, list) == 3);
+        REQUIRE(list.count == 3);
+        REQUIRE(list.events[0].tick == 0);
+        REQUIRE(list.events[1].tick == 48);
+        REQUIRE(list.events[2].tick == 96);
+        for (int i = 0; i < list.count; i++) {
+            REQUIRE(list.events[i].offset == 0);
+            REQUIRE(list.events[i].level == 255);
+        }
+    }
+    
+    SECTION("Hits at or past the bar length are ignored") {
+        bits.set(10);
+        bits.set(192);
+        
+        REQUIRE(compileEvents(bits, 192, list) == 1);
+        REQUIRE(list.events[0].tick == 10);
+    }
+    
+    SECTION("A bar that does not fit is kept as a grid") {
+        OffGridHits offGrid = {};
+        for (int i = 0; i < MAX_BAR_EVENTS; i++) {
+            bits.set(i * 2);
+        }
+        offGrid.positions[offGrid.count++] = 5 * SUBTICKS_PER_TICK + 100;
+        offGrid.positions[offGrid.count++] = MAX_TICKS_PER_BAR * SUBTICKS_PER_TICK + 1;  // past the bar
+        
+        REQUIRE(compileEvents(bits, MAX_TICKS_PER_BAR, list, &offGrid) == -1);
+        REQUIRE(list.overflow);
+        REQUIRE(list.count == 0);
+        REQUIRE(countHits(list.grid) == MAX_BAR_EVENTS + 1);
+        REQUIRE(list.grid.test(5));
+        REQUIRE(list.grid.test((MAX_BAR_EVENTS - 1) * 2));
+    }
+    
+    SECTION("A bar that exactly fits stays a list") {
+        for (int i = 0; i < MAX_BAR_EVENTS; i++) {
+            bits.set(i);
+        }
+        
+        REQUIRE(compileEvents(bits, MAX_TICKS_PER_BAR, list) == MAX_BAR_EVENTS);
+        REQUIRE_FALSE(list.overflow);
+        REQUIRE(list.events[MAX_BAR_EVENTS - 1].tick == MAX_BAR_EVENTS - 1);
+    }
+}
+
+TEST_CASE("Event list - off-grid hits", "[event_list]") {
+    PatternBits bits = {};
+    OffGridHits offGrid = {};
+    EventList list = {};
+    
+    SECTION("Whole-tick positions land on the grid") {
+        placeFineHit(&bits, &offGrid, 3 * SUBTICKS_PER_TICK);
+        REQUIRE(bits.test(3));
+        REQUIRE(offGrid.count == 0);
+    }
+    
+    SECTION("Positions between ticks go to the off-grid list") {
+        placeFineHit(&bits, &offGrid, 3 * SUBTICKS_PER_TICK + 85);
+        REQUIRE(countHits(bits) == 0);
+        REQUIRE(offGrid.count == 1);
+        REQUIRE(offGrid.positions[0] == 3 * SUBTICKS_PER_TICK + 85);
+    }
+    
+    SECTION("Without room in the off-grid list, hits round down onto the grid") {
+        placeFineHit(&bits, nullptr, 3 * SUBTICKS_PER_TICK + 85);
+        REQUIRE(bits.test(3));
+        
+        offGrid.count = MAX_OFF_GRID_HITS;
+        placeFineHit(&bits, &offGrid, 7 * SUBTICKS_PER_TICK + 200);
+        REQUIRE(bits.test(7));
+        REQUIRE(offGrid.count == MAX_OFF_GRID_HITS);
+    }
+    
+    SECTION("Off-grid hits are merged in time order and deduplicated") {
+        bits.set(0);
+        bits.set(2);
+        placeFineHit(&bits, &offGrid, 2 * SUBTICKS_PER_TICK + 128);
+        placeFineHit(&bits, &offGrid, 0 * SUBTICKS_PER_TICK + 171);
+        placeFineHit(&bits, &offGrid, 0 * SUBTICKS_PER_TICK + 171);
+        placeFineHit(&bits, &offGrid, 16 * SUBTICKS_PER_TICK + 1);  // past the bar
+        
+        REQUIRE(compileEvents(bits, 16, list, &offGrid) == 4);
+        REQUIRE(list.events[0].tick == 0);
+        REQUIRE(list.events[0].offset == 0);
+        REQUIRE(list.events[1].tick == 0);
+        REQUIRE(list.events[1].offset == 171);
+        REQUIRE(list.events[2].tick == 2);
+        REQUIRE(list.events[2].offset == 0);
+        REQUIRE(list.events[3].tick == 2);
+        REQUIRE(list.events[3].offset == 128);
+    }
+}
+
+TEST_CASE("Event list - playback cursor", "[event_list]") {
+    PatternBits bits = {};
+    bits.set(0);
+    bits.set(12);
+    bits.set(30);
+    EventList list = {};
+    compileEvents(bits, 48, list);
+    uint16_t cursor = 0;
+    
+    SECTION("Walking every tick finds each event once") {
+        int found = 0;
+        for (int tick = 0; tick < 48; tick++) {
+            const int n = eventsAtTick(list, cursor, tick);
+            for (int k = 0; k < n; k++) {
+                REQUIRE(list.events[cursor + k].tick == tick);
+            }
+            cursor = (uint16_t)(cursor + n);
+            found += n;
+        }
+        REQUIRE(found == 3);
+        REQUIRE(cursor == 3);
+    }
+    
+    SECTION("Skipped ticks do not stall the cursor") {
+        REQUIRE(eventsAtTick(list, cursor, 20) == 0);
+        REQUIRE(cursor == 2);
+        REQUIRE(eventsAtTick(list, cursor, 30) == 1);
+    }
+    
+    SECTION("Moving backwards rewinds") {
+        REQUIRE(eventsAtTick(list, cursor, 30) == 1);
+        cursor++;
+        REQUIRE(eventsAtTick(list, cursor, 0) == 1);
+        REQUIRE(cursor == 0);
+    }
+    
+    SECTION("All events of a tick are returned together") {
+        OffGridHits offGrid = {};
+        placeFineHit(&bits, &offGrid, 12 * SUBTICKS_PER_TICK + 128);
+        compileEvents(bits, 48, list, &offGrid);
+        
+        REQUIRE(eventsAtTick(list, cursor, 12) == 2);
+        REQUIRE(list.events[cursor].offset == 0);
+        REQUIRE(list.events[cursor + 1].offset == 128);
+    }
+}
@@ -0,0 +1,72 @@
+#include "catch.hpp"
+#include "../fuel_injector.h"
+
+TEST_CASE("Event scan - rising edge detection", "[event_scan]") {
+    uint16_t masks[8] = {};
+    
+    SECTION("Detects edges and carries the previous sample across blocks") {
+        float samples[8] = {0.0f, 5.0f, 5.0f, 0.0f, 0.0f, 5.0f, 0.0f, 5.0f};
+        float previous = 0.0f;
+        
+        int count = scanRisingEdges(samples, 8, previous, 1.0f, masks, FRAME_EVENT_CLOCK);
+        
+        REQUIRE(count == 3);
+        REQUIRE(masks[1] == FRAME_EVENT_CLOCK);
+        REQUIRE(masks[5] == FRAME_EVENT_CLOCK);
+        REQUIRE(masks[7] == FRAME_EVENT_CLOCK);
+        REQUIRE(masks[2] == 0);
+        REQUIRE(previous == 5.0f);
+    }
+    
+    SECTION("High level held from the previous block is not an edge") {
+        float samples[4] = {5.0f, 5.0f, 0.0f, 0.0f};
+        float previous = 5.0f;
+        
+        int count = scanRisingEdges(samples, 4, previous, 1.0f, masks, FRAME_EVENT_CLOCK);
+        
+        REQUIRE(count == 0);
+        REQUIRE(masks[0] == 0);
+        REQUIRE(previous == 0.0f);
+    }
+    
+    SECTION("Threshold is inclusive") {
+        float samples[2] = {0.5f, 1.0f};
+        float previous = 0.0f;
+        
+        int count = scanRisingEdges(samples, 2, previous, 1.0f, masks, 1);
+        
+        REQUIRE(count == 1);
+        REQUIRE(masks[1] == 1);
+    }
+}
+
+TEST_CASE("Event scan - event list", "[event_scan]") {
+    uint16_t masks[8] = {};
+    FrameEvent events[8];
+    
+    SECTION("No edges produce no events") {
+        REQUIRE(buildFrameEvents(masks, 8, events) == 0);
+    }
+    
+    SECTION("Edges from several buses merge into frame-ordered events") {
+        float clock[8] = {0.0f, 0.0f, 5.0f, 5.0f, 0.0f, 0.0f, 5.0f, 5.0f};
+        float reset[8] = {0.0f, 0.0f, 5.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+        float trig[8] = {5.0f, 0.0f, 0.0f, 5.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+        float prevClock = 0.0f, prevReset = 0.0f, prevTrig = 0.0f;
+        
+        scanRisingEdges(clock, 8, prevClock, 1.0f, masks, FRAME_EVENT_CLOCK);
+        scanRisingEdges(reset, 8, prevReset, 1.0f, masks, FRAME_EVENT_RESET);
+        scanRisingEdges(trig, 8, prevTrig, 1.0f, masks, 1 << 2);
+        
+        int count = buildFrameEvents(masks, 8, events);
+        
+        REQUIRE(count == 4);
+        REQUIRE(events[0].frame == 0);
+        REQUIRE(events[0].mask == (1 << 2));
+        REQUIRE(events[1].frame == 2);
+        REQUIRE(events[1].mask == (FRAME_EVENT_CLOCK | FRAME_EVENT_RESET));
+        REQUIRE(events[2].frame == 3);
+        REQUIRE(events[3].frame == 6);
+        REQUIRE(events[3].mask == FRAME_EVENT_CLOCK);
+    }
+}
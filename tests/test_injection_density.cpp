@@ -5,10 +5,9 @@ TEST_CASE("Density Burst Injection", "[injection][density]") {
     
     SECTION("selectBeatsForDensityBurst selects existing beats") {
         ChannelPattern pattern = {};
-        pattern.hit_positions_bar1[0] = 1;
-        pattern.hit_positions_bar1[48] = 1;
-        pattern.hit_positions_bar1[96] = 1;
-        pattern.hit_count_bar1 = 3;
+        recordHit(pattern, 0, 0);
+        recordHit(pattern, 0, 48);
+        recordHit(pattern, 0, 96);
         
         uint8_t burst_beat_indices[MAX_TICKS_PER_BAR];
         uint8_t burst_count = 0;
@@ -17,65 +16,66 @@ TEST_CASE("Density Burst Injection", "[injection][density]") {
         uint16_t pattern_length = 192;
         uint16_t ppqn = 48;
         
-        selectBeatsForDensityBurst(&pattern, burst_beat_indices, &burst_count, 100, &rng, pattern_length, ppqn);
+        HitIndex index;
+        buildHitIndex(index, recordedBar(pattern, 0), pattern_length, ppqn);
+        selectBeatsForDensityBurst(index, burst_beat_indices, &burst_count, 100, &rng);
         
         REQUIRE(burst_count >= 0);
         REQUIRE(burst_count <= 3);
     }
     
     SECTION("applyDensityBurstInjection adds subdivision hits") {
-        bool output_pattern[MAX_TICKS_PER_BAR] = {};
-        output_pattern[0] = true;
+        PatternBits output_pattern = {};
+        output_pattern.set(0);
         
         uint8_t burst_beat_indices[MAX_TICKS_PER_BAR] = {0};
         uint8_t burst_count = 1;
         uint16_t ppqn = 48;
         
-        applyDensityBurstInjection(output_pattern, burst_beat_indices, burst_count, ppqn);
+        applyDensityBurstInjection(&output_pattern, burst_beat_indices, burst_count, ppqn);
         
-        REQUIRE(output_pattern[0] == true);
-        REQUIRE(output_pattern[ppqn / 2] == true);
+        REQUIRE(output_pattern.test(0) == true);
+        REQUIRE(output_pattern.test(ppqn / 2) == true);
     }
     
     SECTION("density burst creates eighth note subdivisions") {
-        bool output_pattern[MAX_TICKS_PER_BAR] = {};
-        output_pattern[48] = true;
+        PatternBits output_pattern = {};
+        output_pattern.set(48);
         
         uint8_t burst_beat_indices[MAX_TICKS_PER_BAR] = {1};
         uint8_t burst_count = 1;
         uint16_t ppqn = 48;
         
-        applyDensityBurstInjection(output_pattern, burst_beat_indices, burst_count, ppqn);
+        applyDensityBurstInjection(&output_pattern, burst_beat_indices, burst_count, ppqn);
         
         uint16_t beat_start = 48;
         uint16_t eighth_spacing = ppqn / 2;
         
-        REQUIRE(output_pattern[beat_start] == true);
-        REQUIRE(output_pattern[beat_start + eighth_spacing] == true);
+        REQUIRE(output_pattern.test(beat_start) == true);
+        REQUIRE(output_pattern.test(beat_start + eighth_spacing) == true);
     }
     
     SECTION("density burst only affects selected beats") {
-        bool output_pattern[MAX_TICKS_PER_BAR] = {};
-        output_pattern[0] = true;
-        output_pattern[48] = true;
-        output_pattern[96] = true;
+        PatternBits output_pattern = {};
+        output_pattern.set(0);
+        output_pattern.set(48);
+        output_pattern.set(96);
         
         uint8_t burst_beat_indices[MAX_TICKS_PER_BAR] = {1};
         uint8_t burst_count = 1;
         uint16_t ppqn = 48;
         
-        applyDensityBurstInjection(output_pattern, burst_beat_indices, burst_count, ppqn);
+        applyDensityBurstInjection(&output_pattern, burst_beat_indices, burst_count, ppqn);
         
-        REQUIRE(output_pattern[24] == false);
-        REQUIRE(output_pattern[72] == true);
-        REQUIRE(output_pattern[120] == false);
+        REQUIRE(output_pattern.test(24) == false);
+        REQUIRE(output_pattern.test(72) == true);
+        REQUIRE(output_pattern.test(120) == false);
     }
     
     SECTION("density burst respects Fuel scaling") {
         ChannelPattern pattern = {};
-        pattern.hit_positions_bar1[0] = 1;
-        pattern.hit_positions_bar1[48] = 1;
-        pattern.hit_count_bar1 = 2;
+        recordHit(pattern, 0, 0);
+        recordHit(pattern, 0, 48);
         
         uint8_t burst_beat_indices[MAX_TICKS_PER_BAR];
         uint8_t burst_count = 0;
@@ -84,14 +84,15 @@ TEST_CASE("Density Burst Injection", "[injection][density]") {
         uint16_t pattern_length = 96;
         uint16_t ppqn = 48;
         
-        selectBeatsForDensityBurst(&pattern, burst_beat_indices, &burst_count, 0, &rng, pattern_length, ppqn);
+        HitIndex index;
+        buildHitIndex(index, recordedBar(pattern, 0), pattern_length, ppqn);
+        selectBeatsForDensityBurst(index, burst_beat_indices, &burst_count, 0, &rng);
         
         REQUIRE(burst_count == 0);
     }
     
     SECTION("empty pattern produces no density burst") {
         ChannelPattern pattern = {};
-        pattern.hit_count_bar1 = 0;
         
         uint8_t burst_beat_indices[MAX_TICKS_PER_BAR];
         uint8_t burst_count = 0;
@@ -100,23 +101,39 @@ TEST_CASE("Density Burst Injection", "[injection][density]") {
         uint16_t pattern_length = 192;
         uint16_t ppqn = 48;
         
-        selectBeatsForDensityBurst(&pattern, burst_beat_indices, &burst_count, 100, &rng, pattern_length, ppqn);
+        HitIndex index;
+        buildHitIndex(index, recordedBar(pattern, 0), pattern_length, ppqn);
+        selectBeatsForDensityBurst(index, burst_beat_indices, &burst_count, 100, &rng);
         
         REQUIRE(burst_count == 0);
     }
     
     SECTION("density burst stays within pattern bounds") {
-        bool output_pattern[MAX_TICKS_PER_BAR] = {};
-        output_pattern[144] = true;
+        PatternBits output_pattern = {};
+        output_pattern.set(144);
         
         uint8_t burst_beat_indices[MAX_TICKS_PER_BAR] = {3};
         uint8_t burst_count = 1;
         uint16_t ppqn = 48;
         
-        applyDensityBurstInjection(output_pattern, burst_beat_indices, burst_count, ppqn);
+        applyDensityBurstInjection(&output_pattern, burst_beat_indices, burst_count, ppqn);
         
         uint16_t subdivision_pos = 144 + (ppqn / 2);
         REQUIRE(subdivision_pos < MAX_TICKS_PER_BAR);
-        REQUIRE(output_pattern[subdivision_pos] == true);
+        REQUIRE(output_pattern.test(subdivision_pos) == true);
+    }
+    
+    SECTION("density burst at odd PPQN lands exactly halfway through the beat") {
+        PatternBits output_pattern = {};
+        OffGridHits off_grid = {};
+        
+        uint8_t burst_beat_indices[MAX_TICKS_PER_BAR] = {2};
+        uint8_t burst_count = 1;
+        
+        applyDensityBurstInjection(&output_pattern, burst_beat_indices, burst_count, 1, &off_grid);
+        
+        REQUIRE(countHits(output_pattern) == 0);
+        REQUIRE(off_grid.count == 1);
+        REQUIRE(off_grid.positions[0] == 2 * SUBTICKS_PER_TICK + SUBTICKS_PER_TICK / 2);
     }
 }
@@ -5,35 +5,37 @@ TEST_CASE("Hit Omission Injection", "[injection][omission]") {
     
     SECTION("selectHitsForOmission respects 25% limit") {
         ChannelPattern pattern = {};
-        pattern.hit_positions_bar1[0] = 1;
-        pattern.hit_positions_bar1[4] = 1;
-        pattern.hit_positions_bar1[8] = 1;
-        pattern.hit_positions_bar1[12] = 1;
-        pattern.hit_count_bar1 = 4;
+        recordHit(pattern, 0, 0);
+        recordHit(pattern, 0, 4);
+        recordHit(pattern, 0, 8);
+        recordHit(pattern, 0, 12);
         
-        uint8_t omit_indices[MAX_TICKS_PER_BAR];
-        uint8_t omit_count = 0;
+        uint16_t omit_indices[MAX_TICKS_PER_BAR];
+        uint16_t omit_count = 0;
         
         XorShift32 rng = {12345};
         uint16_t pattern_length = 16;
-        selectHitsForOmission(&pattern, omit_indices, &omit_count, 100, &rng, pattern_length);
+        HitIndex index;
+        buildHitIndex(index, recordedBar(pattern, 0), pattern_length, 0);
+        selectHitsForOmission(index, omit_indices, &omit_count, 100, &rng);
         
         REQUIRE(omit_count <= 1);
     }
     
     SECTION("selectHitsForOmission prefers non-downbeat hits") {
         ChannelPattern pattern = {};
-        pattern.hit_positions_bar1[0] = 1;
-        pattern.hit_positions_bar1[4] = 1;
-        pattern.hit_positions_bar1[8] = 1;
-        pattern.hit_count_bar1 = 3;
+        recordHit(pattern, 0, 0);
+        recordHit(pattern, 0, 4);
+        recordHit(pattern, 0, 8);
         
-        uint8_t omit_indices[MAX_TICKS_PER_BAR];
-        uint8_t omit_count = 0;
+        uint16_t omit_indices[MAX_TICKS_PER_BAR];
+        uint16_t omit_count = 0;
         
         XorShift32 rng = {12345};
         uint16_t pattern_length = 16;
-        selectHitsForOmission(&pattern, omit_indices, &omit_count, 100, &rng, pattern_length);
+        HitIndex index;
+        buildHitIndex(index, recordedBar(pattern, 0), pattern_length, 0);
+        selectHitsForOmission(index, omit_indices, &omit_count, 100, &rng);
         
         if (omit_count > 0) {
             REQUIRE(omit_indices[0] != 0);
@@ -42,81 +44,84 @@ TEST_CASE("Hit Omission Injection", "[injection][omission]") {
     
     SECTION("selectHitsForOmission respects probability scaling") {
         ChannelPattern pattern = {};
-        pattern.hit_positions_bar1[4] = 1;
-        pattern.hit_positions_bar1[8] = 1;
-        pattern.hit_positions_bar1[12] = 1;
-        pattern.hit_count_bar1 = 3;
+        recordHit(pattern, 0, 4);
+        recordHit(pattern, 0, 8);
+        recordHit(pattern, 0, 12);
         
-        uint8_t omit_indices[MAX_TICKS_PER_BAR];
-        uint8_t omit_count = 0;
+        uint16_t omit_indices[MAX_TICKS_PER_BAR];
+        uint16_t omit_count = 0;
         
         XorShift32 rng = {12345};
         uint16_t pattern_length = 16;
         
-        selectHitsForOmission(&pattern, omit_indices, &omit_count, 0, &rng, pattern_length);
+        HitIndex index;
+        buildHitIndex(index, recordedBar(pattern, 0), pattern_length, 0);
+        selectHitsForOmission(index, omit_indices, &omit_count, 0, &rng);
         REQUIRE(omit_count == 0);
     }
     
     SECTION("applyOmissionInjection removes selected hits") {
-        bool output_pattern[MAX_TICKS_PER_BAR] = {};
-        output_pattern[4] = true;
-        output_pattern[8] = true;
-        output_pattern[12] = true;
+        PatternBits output_pattern = {};
+        output_pattern.set(4);
+        output_pattern.set(8);
+        output_pattern.set(12);
         
-        uint8_t omit_indices[MAX_TICKS_PER_BAR] = {8};
-        uint8_t omit_count = 1;
+        uint16_t omit_indices[MAX_TICKS_PER_BAR] = {8};
+        uint16_t omit_count = 1;
         
-        applyOmissionInjection(output_pattern, omit_indices, omit_count);
+        applyOmissionInjection(&output_pattern, omit_indices, omit_count);
         
-        REQUIRE(output_pattern[4] == true);
-        REQUIRE(output_pattern[8] == false);
-        REQUIRE(output_pattern[12] == true);
+        REQUIRE(output_pattern.test(4) == true);
+        REQUIRE(output_pattern.test(8) == false);
+        REQUIRE(output_pattern.test(12) == true);
     }
     
     SECTION("applyOmissionInjection handles multiple omissions") {
-        bool output_pattern[MAX_TICKS_PER_BAR] = {};
-        output_pattern[4] = true;
-        output_pattern[8] = true;
-        output_pattern[12] = true;
+        PatternBits output_pattern = {};
+        output_pattern.set(4);
+        output_pattern.set(8);
+        output_pattern.set(12);
         
-        uint8_t omit_indices[MAX_TICKS_PER_BAR] = {4, 12};
-        uint8_t omit_count = 2;
+        uint16_t omit_indices[MAX_TICKS_PER_BAR] = {4, 12};
+        uint16_t omit_count = 2;
         
-        applyOmissionInjection(output_pattern, omit_indices, omit_count);
+        applyOmissionInjection(&output_pattern, omit_indices, omit_count);
         
-        REQUIRE(output_pattern[4] == false);
-        REQUIRE(output_pattern[8] == true);
-        REQUIRE(output_pattern[12] == false);
+        REQUIRE(output_pattern.test(4) == false);
+        REQUIRE(output_pattern.test(8) == true);
+        REQUIRE(output_pattern.test(12) == false);
     }
     
     SECTION("omission respects Fuel parameter scaling") {
         ChannelPattern pattern = {};
-        pattern.hit_positions_bar1[4] = 1;
-        pattern.hit_positions_bar1[8] = 1;
-        pattern.hit_positions_bar1[12] = 1;
-        pattern.hit_count_bar1 = 3;
+        recordHit(pattern, 0, 4);
+        recordHit(pattern, 0, 8);
+        recordHit(pattern, 0, 12);
         
-        uint8_t omit_indices[MAX_TICKS_PER_BAR];
-        uint8_t omit_count = 0;
+        uint16_t omit_indices[MAX_TICKS_PER_BAR];
+        uint16_t omit_count = 0;
         
         XorShift32 rng = {12345};
         uint16_t pattern_length = 16;
         
-        selectHitsForOmission(&pattern, omit_indices, &omit_count, 50, &rng, pattern_length);
+        HitIndex index;
+        buildHitIndex(index, recordedBar(pattern, 0), pattern_length, 0);
+        selectHitsForOmission(index, omit_indices, &omit_count, 50, &rng);
         
         REQUIRE(omit_count <= 1);
     }
     
     SECTION("empty pattern produces no omissions") {
         ChannelPattern pattern = {};
-        pattern.hit_count_bar1 = 0;
         
-        uint8_t omit_indices[MAX_TICKS_PER_BAR];
-        uint8_t omit_count = 0;
+        uint16_t omit_indices[MAX_TICKS_PER_BAR];
+        uint16_t omit_count = 0;
         
         XorShift32 rng = {12345};
         uint16_t pattern_length = 16;
-        selectHitsForOmission(&pattern, omit_indices, &omit_count, 100, &rng, pattern_length);
+        HitIndex index;
+        buildHitIndex(index, recordedBar(pattern, 0), pattern_length, 0);
+        selectHitsForOmission(index, omit_indices, &omit_count, 100, &rng);
         
         REQUIRE(omit_count == 0);
     }
@@ -22,63 +22,63 @@ TEST_CASE("Sub-Bar Permutation Injection", "[injection][permutation]") {
     }
     
     SECTION("applyPermutationInjection reorders eighth-note segments") {
-        bool input_pattern[MAX_TICKS_PER_BAR] = {};
-        input_pattern[0] = true;
-        input_pattern[24] = true;
-        input_pattern[48] = true;
+        PatternBits input_pattern = {};
+        input_pattern.set(0);
+        input_pattern.set(24);
+        input_pattern.set(48);
         
-        bool output_pattern[MAX_TICKS_PER_BAR] = {};
+        PatternBits output_pattern = {};
         
         uint8_t permutation[8] = {1, 0, 2, 3, 4, 5, 6, 7};
         uint16_t ppqn = 48;
         uint16_t pattern_length = 192;
         
-        applyPermutationInjection(input_pattern, output_pattern, permutation, ppqn, pattern_length);
+        applyPermutationInjection(&input_pattern, &output_pattern, permutation, ppqn, pattern_length);
         
-        REQUIRE(output_pattern[24] == true);
-        REQUIRE(output_pattern[0] == true);
-        REQUIRE(output_pattern[48] == true);
+        REQUIRE(output_pattern.test(24) == true);
+        REQUIRE(output_pattern.test(0) == true);
+        REQUIRE(output_pattern.test(48) == true);
     }
     
     SECTION("permutation preserves all hits") {
-        bool input_pattern[MAX_TICKS_PER_BAR] = {};
-        input_pattern[0] = true;
-        input_pattern[12] = true;
-        input_pattern[24] = true;
-        input_pattern[48] = true;
+        PatternBits input_pattern = {};
+        input_pattern.set(0);
+        input_pattern.set(12);
+        input_pattern.set(24);
+        input_pattern.set(48);
         
-        bool output_pattern[MAX_TICKS_PER_BAR] = {};
+        PatternBits output_pattern = {};
         
         uint8_t permutation[8] = {2, 1, 0, 3, 4, 5, 6, 7};
         uint16_t ppqn = 48;
         uint16_t pattern_length = 192;
         
-        applyPermutationInjection(input_pattern, output_pattern, permutation, ppqn, pattern_length);
+        applyPermutationInjection(&input_pattern, &output_pattern, permutation, ppqn, pattern_length);
         
         int input_count = 0;
         int output_count = 0;
         for (int i = 0; i < pattern_length; i++) {
-            if (input_pattern[i]) input_count++;
-            if (output_pattern[i]) output_count++;
+            if (input_pattern.test(i)) input_count++;
+            if (output_pattern.test(i)) output_count++;
         }
         
         REQUIRE(input_count == output_count);
     }
     
     SECTION("permutation respects eighth-note granularity") {
-        bool input_pattern[MAX_TICKS_PER_BAR] = {};
-        input_pattern[0] = true;
+        PatternBits input_pattern = {};
+        input_pattern.set(0);
         
-        bool output_pattern[MAX_TICKS_PER_BAR] = {};
+        PatternBits output_pattern = {};
         
         uint8_t permutation[8] = {1, 0, 2, 3, 4, 5, 6, 7};
         uint16_t ppqn = 48;
         uint16_t pattern_length = 192;
         
-        applyPermutationInjection(input_pattern, output_pattern, permutation, ppqn, pattern_length);
+        applyPermutationInjection(&input_pattern, &output_pattern, permutation, ppqn, pattern_length);
         
         uint16_t eighth_note = ppqn / 2;
-        REQUIRE(output_pattern[eighth_note] == true);
+        REQUIRE(output_pattern.test(eighth_note) == true);
     }
     
     SECTION("permutation respects Fuel scaling") {
@@ -93,43 +93,58 @@ TEST_CASE("Sub-Bar Permutation Injection", "[injection][permutation]") {
     }
     
     SECTION("identity permutation produces same pattern") {
-        bool input_pattern[MAX_TICKS_PER_BAR] = {};
-        input_pattern[0] = true;
-        input_pattern[24] = true;
-        input_pattern[48] = true;
+        PatternBits input_pattern = {};
+        input_pattern.set(0);
+        input_pattern.set(24);
+        input_pattern.set(48);
         
-        bool output_pattern[MAX_TICKS_PER_BAR] = {};
+        PatternBits output_pattern = {};
         
         uint8_t permutation[8] = {0, 1, 2, 3, 4, 5, 6, 7};
         uint16_t ppqn = 48;
         uint16_t pattern_length = 192;
         
-        applyPermutationInjection(input_pattern, output_pattern, permutation, ppqn, pattern_length);
+        applyPermutationInjection(&input_pattern, &output_pattern, permutation, ppqn, pattern_length);
         
         for (int i = 0; i < pattern_length; i++) {
-            REQUIRE(output_pattern[i] == input_pattern[i]);
+            REQUIRE(output_pattern.test(i) == input_pattern.test(i));
         }
     }
     
     SECTION("permutation handles full bar") {
-        bool input_pattern[MAX_TICKS_PER_BAR] = {};
+        PatternBits input_pattern = {};
         for (int i = 0; i < 192; i += 24) {
-            input_pattern[i] = true;
+            input_pattern.set(i);
         }
         
-        bool output_pattern[MAX_TICKS_PER_BAR] = {};
+        PatternBits output_pattern = {};
         
         uint8_t permutation[8] = {7, 6, 5, 4, 3, 2, 1, 0};
         uint16_t ppqn = 48;
         uint16_t pattern_length = 192;
         
-        applyPermutationInjection(input_pattern, output_pattern, permutation, ppqn, pattern_length);
+        applyPermutationInjection(&input_pattern, &output_pattern, permutation, ppqn, pattern_length);
         
         int output_count = 0;
         for (int i = 0; i < pattern_length; i++) {
-            if (output_pattern[i]) output_count++;
+            if (output_pattern.test(i)) output_count++;
         }
         
         REQUIRE(output_count == 8);
     }
+    
+    SECTION("off-grid hits move with their segment") {
+        OffGridHits off_grid = {};
+        off_grid.count = 2;
+        off_grid.positions[0] = 1 * SUBTICKS_PER_TICK + 100;  // segment 0
+        off_grid.positions[1] = 5 * SUBTICKS_PER_TICK + 64;   // segment 2
+        
+        uint8_t permutation[4] = {0, 2, 1, 3};
+        
+        permuteOffGridHits(&off_grid, permutation, 4, 8);
+        
+        REQUIRE(off_grid.count == 2);
+        REQUIRE(off_grid.positions[0] == 1 * SUBTICKS_PER_TICK + 100);
+        REQUIRE(off_grid.positions[1] == 3 * SUBTICKS_PER_TICK + 64);
+    }
 }
@@ -0,0 +1,156 @@
+#include "catch.hpp"
+#include "../fuel_injector.h"
+
+TEST_CASE("Pattern bitset - storage", "[pattern_bits]") {
+    PatternBits bits = {};
+    
+    SECTION("One bar packs into 11 words") {
+        REQUIRE(PATTERN_WORDS == 11);
+        REQUIRE(sizeof(PatternBits) == 44);
+    }
+    
+    SECTION("Set, test and reset individual ticks") {
+        bits.set(0);
+        bits.set(31);
+        bits.set(32);
+        bits.set(MAX_TICKS_PER_BAR - 1);
+        
+        REQUIRE(bits.test(0));
+        REQUIRE(bits.test(31));
+        REQUIRE(bits.test(32));
+        REQUIRE(bits.test(MAX_TICKS_PER_BAR - 1));
+        REQUIRE_FALSE(bits.test(1));
+        REQUIRE(countHits(bits) == 4);
+        
+        bits.reset(31);
+        REQUIRE_FALSE(bits.test(31));
+        REQUIRE(countHits(bits) == 3);
+        
+        bits.clear();
+        REQUIRE(countHits(bits) == 0);
+    }
+}
+
+TEST_CASE("Pattern bitset - popcount", "[pattern_bits]") {
+    REQUIRE(popcount32(0u) == 0);
+    REQUIRE(popcount32(1u) == 1);
+    REQUIRE(popcount32(0x80000000u) == 1);
+    REQUIRE(popcount32(0xFFFFFFFFu) == 32);
+    REQUIRE(popcount32(0x0F0F00F1u) == 13);
+}
+
+TEST_CASE("Pattern bitset - set operations", "[pattern_bits]") {
+    PatternBits a = {};
+    PatternBits b = {};
+    a.set(10);
+    a.set(100);
+    a.set(200);
+    b.set(10);
+    b.set(200);
+    b.set(300);
+    
+    REQUIRE(countCommonHits(a, b) == 2);
+    REQUIRE(countCombinedHits(a, b) == 4);
+}
+
+TEST_CASE("Pattern bitset - hit iteration", "[pattern_bits]") {
+    PatternBits bits = {};
+    bits.set(3);
+    bits.set(64);
+    bits.set(191);
+    bits.set(250);
+    
+    SECTION("Walks hits in order across words") {
+        REQUIRE(findNextHit(bits, 0, MAX_TICKS_PER_BAR) == 3);
+        REQUIRE(findNextHit(bits, 4, MAX_TICKS_PER_BAR) == 64);
+        REQUIRE(findNextHit(bits, 65, MAX_TICKS_PER_BAR) == 191);
+        REQUIRE(findNextHit(bits, 192, MAX_TICKS_PER_BAR) == 250);
+        REQUIRE(findNextHit(bits, 251, MAX_TICKS_PER_BAR) == -1);
+    }
+    
+    SECTION("Respects the pattern length limit") {
+        REQUIRE(findNextHit(bits, 65, 192) == 191);
+        REQUIRE(findNextHit(bits, 192, 192) == -1);
+        REQUIRE(findNextHit(bits, 65, 191) == -1);
+    }
+    
+    SECTION("Empty pattern has no hits") {
+        PatternBits empty = {};
+        REQUIRE(findNextHit(empty, 0, MAX_TICKS_PER_BAR) == -1);
+    }
+}
+
+TEST_CASE("Pattern bitset - hit index", "[pattern_bits]") {
+    PatternBits bits = {};
+    bits.set(0);
+    bits.set(12);
+    bits.set(13);
+    bits.set(96);
+    bits.set(300);
+    
+    HitIndex index;
+    buildHitIndex(index, bits, 288, 48);
+    
+    SECTION("Lists hits in order up to the bar length") {
+        REQUIRE(index.count == 4);
+        REQUIRE(index.positions[0] == 0);
+        REQUIRE(index.positions[1] == 12);
+        REQUIRE(index.positions[2] == 13);
+        REQUIRE(index.positions[3] == 96);
+    }
+    
+    SECTION("Lists the beats that carry a hit") {
+        REQUIRE(index.beat_count == 2);
+        REQUIRE(index.beats[0] == 0);
+        REQUIRE(index.beats[1] == 2);
+    }
+    
+    SECTION("Is current only for the bar and grid it was built from") {
+        REQUIRE(hitIndexCurrent(index, bits, 288, 48));
+        REQUIRE_FALSE(hitIndexCurrent(index, bits, 192, 48));
+        REQUIRE_FALSE(hitIndexCurrent(index, bits, 288, 24));
+        bits.set(50);
+        REQUIRE_FALSE(hitIndexCurrent(index, bits, 288, 48));
+    }
+    
+    SECTION("Omission spares the downbeat and picks from the index") {
+        uint16_t omit_indices[MAX_TICKS_PER_BAR];
+        uint16_t omit_count = 0;
+        XorShift32 rng = {12345};
+        selectHitsForOmission(index, omit_indices, &omit_count, 100, &rng);
+        REQUIRE(omit_count == 1);
+        REQUIRE(omit_indices[0] != 0);
+        REQUIRE(bits.test(omit_indices[0]));
+    }
+    
+    SECTION("Omission and rolls reach hits past tick 255") {
+        PatternBits wide = {};
+        wide.set(0);
+        wide.set(300);
+        HitIndex wideIndex;
+        buildHitIndex(wideIndex, wide, 336, 48);
+        XorShift32 rng = {12345};
+        
+        uint16_t omit_indices[MAX_TICKS_PER_BAR];
+        uint16_t omit_count = 0;
+        selectHitsForOmission(wideIndex, omit_indices, &omit_count, 100, &rng);
+        REQUIRE(omit_count == 1);
+        REQUIRE(omit_indices[0] == 300);
+        PatternBits omitted = wide;
+        applyOmissionInjection(&omitted, omit_indices, omit_count);
+        REQUIRE_FALSE(omitted.test(300));
+        REQUIRE(omitted.test(0));
+        
+        uint16_t roll_indices[MAX_TICKS_PER_BAR];
+        uint16_t roll_count = 0;
+        uint8_t roll_subdivisions[MAX_TICKS_PER_BAR];
+        selectHitsForRoll(wideIndex, roll_indices, &roll_count, roll_subdivisions, 100, &rng);
+        REQUIRE(roll_count == 2);
+        REQUIRE(roll_indices[1] == 300);
+        PatternBits rolled = wide;
+        roll_subdivisions[1] = 2;
+        applyRollInjection(&rolled, roll_indices + 1, 1, roll_subdivisions + 1, 48);
+        REQUIRE(rolled.test(324));
+        REQUIRE_FALSE(rolled.test(300 - 256 + 24));
+    }
+}
@@ -6,20 +6,20 @@ TEST_CASE("Pattern learning - hit detection", "[pattern_learning]") {
     
     SECTION("Record hit at tick position") {
         recordHit(pattern, 0, 10);
-        REQUIRE(pattern.hit_positions_bar1[10] == 1);
+        REQUIRE(recordedBar(pattern, 0).test(10));
     }
     
     SECTION("Multiple hits in same bar") {
         recordHit(pattern, 0, 10);
         recordHit(pattern, 0, 20);
         recordHit(pattern, 0, 30);
-        REQUIRE(pattern.hit_count_bar1 == 3);
+        REQUIRE(recordedHitCount(pattern, 0) == 3);
     }
     
     SECTION("Hits in second bar") {
         recordHit(pattern, 1, 10);
         recordHit(pattern, 1, 20);
-        REQUIRE(pattern.hit_count_bar2 == 2);
+        REQUIRE(recordedHitCount(pattern, 1) == 2);
     }
 }
 
@@ -88,18 +88,639 @@ TEST_CASE("Pattern learning - 2 bar history", "[pattern_learning]") {
         recordHit(pattern, 0, 10);
         recordHit(pattern, 1, 20);
         
-        REQUIRE(pattern.hit_count_bar1 > 0);
-        REQUIRE(pattern.hit_count_bar2 > 0);
+        REQUIRE(recordedHitCount(pattern, 0) > 0);
+        REQUIRE(recordedHitCount(pattern, 1) > 0);
     }
     
     SECTION("Oldest bar discarded on new bar") {
         recordHit(pattern, 0, 10);
         recordHit(pattern, 1, 20);
         
-        int old_bar1_count = pattern.hit_count_bar1;
+        int old_bar1_count = recordedHitCount(pattern, 0);
         shiftBarsForNewBar(pattern);
         
-        REQUIRE(pattern.hit_count_bar2 == old_bar1_count);
-        REQUIRE(pattern.hit_count_bar1 == 0);
+        REQUIRE(recordedHitCount(pattern, 1) == old_bar1_count);
+        REQUIRE(recordedHitCount(pattern, 0) == 0);
+    }
+}
+
+TEST_CASE("Pattern learning - ping-pong bar slots", "[pattern_learning]") {
+    ChannelPattern pattern = {};
+    
+    SECTION("Rotation moves the current bar to the previous slot without copying") {
+        recordHit(pattern, 0, 10);
+        uint8_t slot = pattern.current_slot;
+        
+        shiftBarsForNewBar(pattern);
+        
+        REQUIRE(pattern.current_slot != slot);
+        REQUIRE(recordedBar(pattern, 1).test(10));
+        REQUIRE(countHits(recordedBar(pattern, 0)) == 0);
+    }
+    
+    SECTION("Reused slot is cleared lazily on the first new hit") {
+        recordHit(pattern, 0, 10);
+        shiftBarsForNewBar(pattern);
+        recordHit(pattern, 0, 20);
+        shiftBarsForNewBar(pattern);
+        
+        // The slot holding bar 1 (hit at 10) is now current again but reads empty.
+        REQUIRE(recordedHitCount(pattern, 0) == 0);
+        REQUIRE_FALSE(recordedBar(pattern, 0).test(10));
+        
+        recordHit(pattern, 0, 30);
+        REQUIRE(recordedHitCount(pattern, 0) == 1);
+        REQUIRE(recordedBar(pattern, 0).test(30));
+        REQUIRE_FALSE(recordedBar(pattern, 0).test(10));
+        REQUIRE(recordedBar(pattern, 1).test(20));
+    }
+    
+    SECTION("Similarity ignores stale slots") {
+        recordHit(pattern, 0, 10);
+        shiftBarsForNewBar(pattern);
+        shiftBarsForNewBar(pattern);
+        
+        REQUIRE(calculatePatternSimilarity(pattern) == 100.0f);
+    }
+}
+
+TEST_CASE("Pattern learning - epoch invalidation", "[pattern_learning]") {
+    ChannelPattern pattern = {};
+    
+    SECTION("Pattern from the current epoch is untouched") {
+        recordHit(pattern, 0, 10);
+        shiftBarsForNewBar(pattern);
+        recordHit(pattern, 0, 20);
+        syncPattern(pattern, 0);
+        
+        REQUIRE(recordedBar(pattern, 0).test(20));
+        REQUIRE(recordedBar(pattern, 1).test(10));
+    }
+    
+    SECTION("Bumping the epoch empties both bars") {
+        recordHit(pattern, 0, 10);
+        shiftBarsForNewBar(pattern);
+        recordHit(pattern, 0, 20);
+        syncPattern(pattern, 1);
+        
+        REQUIRE(pattern.epoch == 1);
+        REQUIRE(recordedHitCount(pattern, 0) == 0);
+        REQUIRE(recordedHitCount(pattern, 1) == 0);
+        REQUIRE(countHits(recordedBar(pattern, 0)) == 0);
+        REQUIRE(countHits(recordedBar(pattern, 1)) == 0);
+    }
+    
+    SECTION("Stale bits are cleared on the next recorded hit") {
+        recordHit(pattern, 0, 10);
+        syncPattern(pattern, 1);
+        recordHit(pattern, 0, 30);
+        
+        REQUIRE(recordedHitCount(pattern, 0) == 1);
+        REQUIRE(recordedBar(pattern, 0).test(30));
+        REQUIRE_FALSE(recordedBar(pattern, 0).test(10));
+    }
+    
+    SECTION("Reset bumps the epoch") {
+        _FuelInjector_DTC dtc = {};
+        PatternLearner learner = {};
+        handleReset(&dtc, &learner);
+        handleReset(&dtc, &learner);
+        REQUIRE(dtc.pattern_epoch == 2);
+    }
+}
+
+TEST_CASE("Pattern learning - resampling to a new grid", "[pattern_learning]") {
+    PatternBits in = {};
+    PatternBits out;
+    uint16_t hits = 0;
+    
+    SECTION("Raising PPQN scales positions") {
+        in.set(0);
+        in.set(6);
+        in.set(10);
+        REQUIRE(resampleBar(in, 4, 16, 24, 96, out, hits));
+        REQUIRE(hits == 3);
+        REQUIRE(out.test(0));
+        REQUIRE(out.test(36));
+        REQUIRE(out.test(60));
+    }
+    
+    SECTION("Lowering PPQN works when every hit lands on the coarser grid") {
+        in.set(0);
+        in.set(48);
+        in.set(72);
+        REQUIRE(resampleBar(in, 24, 96, 4, 16, out, hits));
+        REQUIRE(hits == 3);
+        REQUIRE(out.test(0));
+        REQUIRE(out.test(8));
+        REQUIRE(out.test(12));
+    }
+    
+    SECTION("Lowering PPQN is lossy when a hit falls between new ticks") {
+        in.set(0);
+        in.set(50);
+        REQUIRE_FALSE(resampleBar(in, 24, 96, 4, 16, out, hits));
+    }
+    
+    SECTION("Shorter bar drops the tail") {
+        in.set(0);
+        in.set(4);
+        in.set(12);
+        REQUIRE(resampleBar(in, 4, 16, 4, 8, out, hits));
+        REQUIRE(hits == 2);
+        REQUIRE(out.test(0));
+        REQUIRE(out.test(4));
+        REQUIRE_FALSE(out.test(12));
+    }
+    
+    SECTION("Shorter bar is lossy when nothing survives") {
+        in.set(12);
+        REQUIRE_FALSE(resampleBar(in, 4, 16, 4, 8, out, hits));
+    }
+    
+    SECTION("Longer bar repeats the learned beats") {
+        in.set(0);
+        in.set(6);
+        REQUIRE(resampleBar(in, 4, 12, 4, 16, out, hits));
+        REQUIRE(hits == 3);
+        REQUIRE(out.test(0));
+        REQUIRE(out.test(6));
+        REQUIRE(out.test(12));
+        REQUIRE(countHits(out) == 3);
+    }
+    
+    SECTION("Empty pattern resamples to empty") {
+        REQUIRE(resampleBar(in, 4, 16, 24, 96, out, hits));
+        REQUIRE(hits == 0);
+    }
+}
+
+TEST_CASE("Pattern learning - delta-coded hits", "[pattern_learning]") {
+    PatternBits bits = {};
+    uint16_t deltas[MAX_TICKS_PER_BAR];
+    
+    SECTION("Encodes gaps between hits") {
+        bits.set(0);
+        bits.set(6);
+        bits.set(10);
+        bits.set(300);
+        REQUIRE(encodeHitDeltas(bits, MAX_TICKS_PER_BAR, deltas) == 4);
+        REQUIRE(deltas[0] == 0);
+        REQUIRE(deltas[1] == 6);
+        REQUIRE(deltas[2] == 4);
+        REQUIRE(deltas[3] == 290);
+    }
+    
+    SECTION("Round trip restores the bar") {
+        bits.set(3);
+        bits.set(95);
+        bits.set(96);
+        const int count = encodeHitDeltas(bits, 192, deltas);
+        PatternBits out;
+        uint16_t hits = 0;
+        REQUIRE(decodeHitDeltas(deltas, count, 192, out, hits));
+        REQUIRE(hits == 3);
+        REQUIRE(out.test(3));
+        REQUIRE(out.test(95));
+        REQUIRE(out.test(96));
+        REQUIRE(countHits(out) == 3);
+    }
+    
+    SECTION("Rejects positions outside the bar and repeated hits") {
+        PatternBits out;
+        uint16_t hits = 0;
+        const uint16_t tooLong[] = { 10, 10 };
+        REQUIRE_FALSE(decodeHitDeltas(tooLong, 2, 16, out, hits));
+        const uint16_t repeated[] = { 4, 0 };
+        REQUIRE_FALSE(decodeHitDeltas(repeated, 2, 16, out, hits));
+    }
+}
+
+TEST_CASE("Pattern learning - running overlap counts", "[pattern_learning]") {
+    ChannelPattern pattern = {};
+    
+    SECTION("Common hits follow the bar being compared against") {
+        recordHit(pattern, 0, 10);
+        recordHit(pattern, 0, 20);
+        shiftBarsForNewBar(pattern);
+        recordHit(pattern, 0, 10);
+        recordHit(pattern, 0, 30);
+        REQUIRE(recordedCommonHits(pattern) == 1);
+        REQUIRE(recordedCommonHits(pattern) == countCommonHits(recordedBar(pattern, 0), recordedBar(pattern, 1)));
+    }
+    
+    SECTION("Duplicate hits are counted once") {
+        recordHit(pattern, 0, 10);
+        recordHit(pattern, 0, 10);
+        REQUIRE(recordedHitCount(pattern, 0) == 1);
+    }
+    
+    SECTION("Rotation starts a fresh count") {
+        recordHit(pattern, 0, 10);
+        shiftBarsForNewBar(pattern);
+        recordHit(pattern, 0, 10);
+        shiftBarsForNewBar(pattern);
+        REQUIRE(recordedCommonHits(pattern) == 0);
+        recordHit(pattern, 0, 20);
+        REQUIRE(recordedCommonHits(pattern) == 0);
+        recordHit(pattern, 0, 10);
+        REQUIRE(recordedCommonHits(pattern) == 1);
+    }
+    
+    SECTION("Reference hits count matches against the learned bar") {
+        PatternBits learned = {};
+        learned.set(0);
+        learned.set(8);
+        recordHit(pattern, 0, 0, &learned);
+        recordHit(pattern, 0, 4, &learned);
+        recordHit(pattern, 0, 8, &learned);
+        REQUIRE(recordedReferenceHits(pattern) == 2);
+        shiftBarsForNewBar(pattern);
+        REQUIRE(recordedReferenceHits(pattern) == 0);
+    }
+}
+
+TEST_CASE("Pattern learning - fast lock evidence", "[pattern_learning]") {
+    SECTION("Half of a busy bar repeated exactly is enough") {
+        REQUIRE(fastLockConfident(16, 8, 8, 0));
+        REQUIRE_FALSE(fastLockConfident(16, 7, 7, 0));
+    }
+    
+    SECTION("Sparse grooves wait for the bar end") {
+        REQUIRE_FALSE(fastLockConfident(2, 2, 2, 0));
+        REQUIRE_FALSE(fastLockConfident(3, 3, 3, 0));
+        REQUIRE(fastLockConfident(4, 4, 4, 0));
+    }
+    
+    SECTION("Any disagreement so far rules it out") {
+        REQUIRE_FALSE(fastLockConfident(16, 9, 8, 0));
+        REQUIRE_FALSE(fastLockConfident(16, 8, 8, 1));
+        REQUIRE_FALSE(fastLockConfident(0, 0, 0, 0));
+    }
+}
+
+TEST_CASE("Pattern learning - coarse-to-fine", "[pattern_learning]") {
+    // 48 PPQN, one 4/4 bar: 16ths are 12 ticks.
+    const int limit = 192;
+    const int cell = coarseCellTicks(48);
+    PatternBits a = {};
+    PatternBits b = {};
+    
+    SECTION("16th grid only exists above 4 PPQN") {
+        REQUIRE(cell == 12);
+        REQUIRE(coarseCellTicks(24) == 6);
+        REQUIRE(coarseCellTicks(4) == 0);
+        REQUIRE(coarseCellTicks(6) == 0);
+    }
+    
+    SECTION("Swung bars match on the 16th grid") {
+        for (int e = 0; e < 8; e++) {
+            a.set(e * 24);
+            b.set(e * 24 + ((e & 1) ? 4 : -1 + (e == 0)));
+        }
+        ChannelPattern pattern = {};
+        for (int i = findNextHit(a, 0, limit); i >= 0; i = findNextHit(a, i + 1, limit)) recordHit(pattern, 1, i);
+        for (int i = findNextHit(b, 0, limit); i >= 0; i = findNextHit(b, i + 1, limit)) recordHit(pattern, 0, i);
+        REQUIRE(calculatePatternSimilarity(pattern) < 90.0f);
+        REQUIRE(coarseSimilarity(a, b, limit, cell) == 100.0f);
+    }
+    
+    SECTION("Different 16ths still differ") {
+        a.set(0);
+        a.set(48);
+        b.set(0);
+        b.set(60);
+        REQUIRE(coarseSimilarity(a, b, limit, cell) < 90.0f);
+    }
+    
+    SECTION("A late last 16th belongs to the next downbeat") {
+        REQUIRE(coarseCell(190, cell, limit / cell) == 0);
+        REQUIRE(coarseCell(185, cell, limit / cell) == 15);
+    }
+    
+    SECTION("Refinement moves learned hits to the mean played position") {
+        a.set(0);
+        a.set(24);
+        LearnRefinement r;
+        beginRefinement(r, a, limit, cell);
+        REQUIRE(r.bars_left == REFINE_BARS);
+        
+        b.set(2);
+        b.set(28);
+        accumulateRefinement(r, a, b, limit, cell);
+        b.clear();
+        b.set(1);
+        b.set(29);
+        accumulateRefinement(r, a, b, limit, cell);
+        b.clear();
+        b.set(191);
+        b.set(27);
+        accumulateRefinement(r, a, b, limit, cell);
+        
+        PatternBits refined;
+        REQUIRE(applyRefinement(r, a, limit, cell, refined) == 2);
+        // Offsets {0, 2, 1, -1} average to 0.5 -> 1; {0, 4, 5, 3} average to 3.
+        REQUIRE(refined.test(1));
+        REQUIRE(refined.test(27));
+    }
+    
+    SECTION("Crowded 16ths are left alone") {
+        a.set(24);
+        a.set(26);
+        LearnRefinement r;
+        beginRefinement(r, a, limit, cell);
+        b.set(30);
+        accumulateRefinement(r, a, b, limit, cell);
+        PatternBits refined;
+        applyRefinement(r, a, limit, cell, refined);
+        REQUIRE(refined.test(24));
+        REQUIRE(refined.test(26));
+    }
+}
+
+TEST_CASE("Pattern learning - timing tolerance", "[pattern_learning]") {
+    const int limit = 192;
+    PatternBits a = {};
+    PatternBits b = {};
+    PatternBits wide;
+    
+    SECTION("Dilation covers exactly the radius around each hit") {
+        a.set(100);
+        for (int radius = 0; radius <= MAX_TOLERANCE_TICKS; radius++) {
+            dilateBits(a, radius, limit, wide);
+            REQUIRE(countHits(wide) == 2 * radius + 1);
+            REQUIRE(wide.test(100 - radius));
+            REQUIRE(wide.test(100 + radius));
+        }
+    }
+    
+    SECTION("Dilation carries across words and wraps round the bar") {
+        a.set(31);
+        a.set(190);
+        dilateBits(a, 3, limit, wide);
+        REQUIRE(wide.test(28));
+        REQUIRE(wide.test(34));
+        REQUIRE(wide.test(187));
+        REQUIRE(wide.test(191));
+        REQUIRE(wide.test(0));
+        REQUIRE(wide.test(1));
+        REQUIRE_FALSE(wide.test(2));
+        REQUIRE(findNextHit(wide, limit, MAX_TICKS_PER_BAR) < 0);
+    }
+    
+    SECTION("One tick of jitter only matches within the tolerance") {
+        for (int beat = 0; beat < 8; beat++) {
+            a.set(beat * 24);
+            b.set((beat * 24 + ((beat & 1) ? 1 : limit - 1)) % limit);
+        }
+        REQUIRE(toleranceSimilarity(a, b, limit, 0) == 0.0f);
+        REQUIRE(toleranceSimilarity(a, b, limit, 1) == 100.0f);
+    }
+    
+    SECTION("An early downbeat belongs to the next bar") {
+        a.set(0);
+        a.set(96);
+        REQUIRE(carriesToNextBar(a, 190, limit, 2));
+        REQUIRE_FALSE(carriesToNextBar(a, 190, limit, 1));
+        REQUIRE_FALSE(carriesToNextBar(a, 190, limit, 0));
+        REQUIRE_FALSE(carriesToNextBar(a, 180, limit, 2));
+        // A hit expected at the end of the bar keeps it there.
+        a.set(189);
+        REQUIRE_FALSE(carriesToNextBar(a, 190, limit, 2));
+    }
+    
+    SECTION("Two hits inside one window are not both matched") {
+        a.set(48);
+        b.set(47);
+        b.set(49);
+        REQUIRE(toleranceSimilarity(a, b, limit, 1) == Approx(50.0f));
+    }
+}
+
+TEST_CASE("Pattern learning - rotation", "[pattern_learning]") {
+    const int limit = 192;
+    PatternBits learned = {};
+    const int groove[] = { 0, 30, 48, 72, 120, 168 };
+    for (int t : groove) learned.set(t);
+    PatternBits bar;
+    
+    SECTION("Rotation wraps hits past the bar end to the start") {
+        rotateBits(learned, 24, limit, bar);
+        REQUIRE(countHits(bar) == 6);
+        REQUIRE(bar.test(24));
+        REQUIRE(bar.test(0));   // 168 + 24 wraps round
+        REQUIRE(bar.test(144));
+        REQUIRE(findNextHit(bar, limit, MAX_TICKS_PER_BAR) < 0);
+    }
+    
+    SECTION("Correlation finds the rotation back onto the learned bar") {
+        rotateBits(learned, 24, limit, bar);    // source running 24 ticks late
+        int matched;
+        const int shift = bestRotation(bar, learned, limit, 48, matched);
+        REQUIRE(shift == limit - 24);
+        REQUIRE(matched == 6);
+        PatternBits back;
+        rotateBits(bar, shift, limit, back);
+        REQUIRE(countCommonHits(back, learned) == 6);
+    }
+    
+    SECTION("Rotations beyond the window are not tried") {
+        rotateBits(learned, 60, limit, bar);    // more than a beat late
+        int matched;
+        REQUIRE(bestRotation(bar, learned, limit, 48, matched) != limit - 60);
+        REQUIRE(matched < 6);
+        REQUIRE(bestRotation(bar, learned, limit, limit / 2, matched) == limit - 60);
+        REQUIRE(matched == 6);
+    }
+    
+    SECTION("A bar already in phase keeps rotation 0") {
+        int matched;
+        REQUIRE(bestRotation(learned, learned, limit, 48, matched) == 0);
+        REQUIRE(matched == 6);
+    }
+    
+    SECTION("Ties keep the smallest correction") {
+        PatternBits beats = {};
+        for (int b = 0; b < 4; b++) beats.set(b * 48 + 2);
+        PatternBits grid = {};
+        for (int b = 0; b < 4; b++) grid.set(b * 48);
+        int matched;
+        REQUIRE(bestRotation(beats, grid, limit, 48, matched) == limit - 2);
+        REQUIRE(matched == 4);
+    }
+    
+    SECTION("Rotating recorded bars keeps their counts") {
+        ChannelPattern pattern = {};
+        for (int t : groove) {
+            recordHit(pattern, 1, t);
+            recordHit(pattern, 0, t);
+        }
+        rotateRecordedBars(pattern, 10, limit);
+        REQUIRE(recordedBar(pattern, 0).test(10));
+        REQUIRE(recordedBar(pattern, 1).test(178));
+        REQUIRE(recordedHitCount(pattern, 0) == 6);
+        REQUIRE(calculatePatternSimilarity(pattern) == 100.0f);
+    }
+}
+
+TEST_CASE("Pattern learning - known groove cache", "[pattern_learning]") {
+    GrooveCache cache = {};
+    PatternBits grooves[GROOVE_CACHE_SIZE + 1];
+    for (int g = 0; g <= GROOVE_CACHE_SIZE; g++) {
+        grooves[g] = PatternBits();
+        grooves[g].set(0);
+        grooves[g].set(12 * (g + 1));
+    }
+    
+    SECTION("Equal bars share a fingerprint, different ones do not") {
+        PatternBits copy = grooves[0];
+        REQUIRE(patternFingerprint(copy) == patternFingerprint(grooves[0]));
+        REQUIRE(patternFingerprint(grooves[1]) != patternFingerprint(grooves[0]));
+    }
+    
+    SECTION("Remembering the same groove again refreshes its entry") {
+        const int first = rememberGroove(cache, grooves[0], 2, 48, 192, false);
+        rememberGroove(cache, grooves[1], 2, 48, 192, false);
+        REQUIRE(rememberGroove(cache, grooves[0], 2, 48, 192, true) == first);
+        REQUIRE(cache.entries[first].coarse);
+        REQUIRE(cache.entries[first].last_used == cache.use_counter);
+    }
+    
+    SECTION("The same bar on another grid is a different groove") {
+        const int first = rememberGroove(cache, grooves[0], 2, 48, 192, false);
+        REQUIRE(rememberGroove(cache, grooves[0], 2, 24, 96, false) != first);
+    }
+    
+    SECTION("A full cache replaces the least recently used groove") {
+        int slots[GROOVE_CACHE_SIZE];
+        for (int g = 0; g < GROOVE_CACHE_SIZE; g++) {
+            slots[g] = rememberGroove(cache, grooves[g], 2, 48, 192, false);
+        }
+        touchGroove(cache, slots[0]);
+        const int replaced = rememberGroove(cache, grooves[GROOVE_CACHE_SIZE], 2, 48, 192, false);
+        REQUIRE(replaced == slots[1]);
+        REQUIRE(sameBits(cache.entries[replaced].bits, grooves[GROOVE_CACHE_SIZE]));
+        REQUIRE(sameBits(cache.entries[slots[0]].bits, grooves[0]));
+    }
+}
+
+TEST_CASE("Pattern learning - hit histogram", "[pattern_learning]") {
+    const int limit = 192;
+    PatternBits learned = {};
+    for (int beat = 0; beat < 4; beat++) learned.set(beat * 48);
+    HitHistogram h;
+    seedHistogram(h, learned);
+    PatternBits model;
+    
+    SECTION("A fresh histogram stands for the learned bar") {
+        REQUIRE(histogramCount(h, 48) == HISTOGRAM_SEED);
+        REQUIRE(histogramCount(h, 47) == 0);
+        thresholdHistogram(h, HISTOGRAM_THRESHOLD, model);
+        REQUIRE(sameBits(model, learned));
+        REQUIRE(h.model == patternFingerprint(learned));
+    }
+    
+    SECTION("Counters saturate at both ends") {
+        for (int bar = 0; bar < 12; bar++) stepHistogram(h, learned);
+        REQUIRE(histogramCount(h, 0) == HISTOGRAM_MAX);
+        REQUIRE(histogramCount(h, 1) == 0);
+        PatternBits none = {};
+        for (int bar = 0; bar < 12; bar++) stepHistogram(h, none);
+        REQUIRE(histogramCount(h, 0) == 0);
+    }
+    
+    SECTION("Threshold compares every counter value") {
+        for (int level = 0; level <= HISTOGRAM_MAX; level++) {
+            HitHistogram one = {};
+            PatternBits tick = {};
+            tick.set(100);
+            for (int i = 0; i < level; i++) stepHistogram(one, tick);
+            REQUIRE(histogramCount(one, 100) == level);
+            for (int threshold = 1; threshold <= HISTOGRAM_MAX; threshold++) {
+                thresholdHistogram(one, threshold, model);
+                REQUIRE(model.test(100) == (level >= threshold));
+                REQUIRE_FALSE(model.test(101));
+            }
+        }
+    }
+    
+    SECTION("A flam in the learned bar fades out") {
+        PatternBits withFlam = learned;
+        withFlam.set(99);
+        seedHistogram(h, withFlam);
+        for (int bar = 0; bar < 2; bar++) updateHistogram(h, withFlam, withFlam, learned, limit, 0);
+        thresholdHistogram(h, HISTOGRAM_THRESHOLD, model);
+        REQUIRE(sameBits(model, learned));
+    }
+    
+    SECTION("A hit played every bar joins the learned bar") {
+        PatternBits played = learned;
+        played.set(120);
+        for (int bar = 0; bar < HISTOGRAM_THRESHOLD - 1; bar++) updateHistogram(h, learned, learned, played, limit, 0);
+        thresholdHistogram(h, HISTOGRAM_THRESHOLD, model);
+        REQUIRE_FALSE(model.test(120));
+        updateHistogram(h, learned, learned, played, limit, 0);
+        thresholdHistogram(h, HISTOGRAM_THRESHOLD, model);
+        REQUIRE(model.test(120));
+    }
+    
+    SECTION("Hits played within the tolerance keep their learned tick") {
+        PatternBits window;
+        dilateBits(learned, 2, limit, window);
+        PatternBits late = {};
+        for (int beat = 0; beat < 4; beat++) late.set(beat * 48 + 2);
+        for (int bar = 0; bar < 8; bar++) updateHistogram(h, learned, window, late, limit, 2);
+        thresholdHistogram(h, HISTOGRAM_THRESHOLD, model);
+        REQUIRE(sameBits(model, learned));
+        REQUIRE(histogramCount(h, 50) == 0);
+    }
+}
+
+TEST_CASE("Pattern learning - phrase detection", "[pattern_learning]") {
+    BarHistory history = {};
+    syncHistory(history, 1);
+    PatternBits bars[MAX_PHRASE_BARS + 2] = {};
+    for (int i = 0; i < MAX_PHRASE_BARS + 2; i++) bars[i].set(i * 10);
+    
+    SECTION("History reaches back as far as it holds bars") {
+        REQUIRE(historySlot(history, 1) == -1);
+        for (int i = 0; i < 3; i++) pushHistory(history, bars[i], (uint16_t)(i + 1));
+        REQUIRE(history.bars[historySlot(history, 1)].test(20));
+        REQUIRE(history.hit_counts[historySlot(history, 3)] == 1);
+        REQUIRE(historySlot(history, 4) == -1);
+        REQUIRE(historySlot(history, 0) == -1);
+    }
+    
+    SECTION("The oldest bar is replaced once the history is full") {
+        for (int i = 0; i < MAX_PHRASE_BARS + 2; i++) pushHistory(history, bars[i], 1);
+        REQUIRE(history.count == MAX_PHRASE_BARS);
+        REQUIRE(history.bars[historySlot(history, 1)].test((MAX_PHRASE_BARS + 1) * 10));
+        REQUIRE(history.bars[historySlot(history, MAX_PHRASE_BARS)].test(20));
+        REQUIRE(historySlot(history, MAX_PHRASE_BARS + 1) == -1);
+    }
+    
+    SECTION("A new epoch empties the history") {
+        pushHistory(history, bars[0], 1);
+        syncHistory(history, 2);
+        REQUIRE(history.count == 0);
+        REQUIRE(historySlot(history, 1) == -1);
+    }
+    
+    SECTION("A phrase needs a whole period of repeats, and at least Learn Bars") {
+        REQUIRE(phrasePeriod(0) == 2);
+        REQUIRE(phrasePeriod(PHRASE_PERIODS - 1) == MAX_PHRASE_BARS);
+        REQUIRE(phraseMatchesNeeded(4, 2) == 4);
+        REQUIRE(phraseMatchesNeeded(2, 6) == 6);
+        
+        uint8_t matches[PHRASE_PERIODS] = { 0, 3, 0 };
+        REQUIRE(detectedPhrase(matches, 2) == 0);
+        matches[1] = 4;
+        REQUIRE(detectedPhrase(matches, 2) == 4);
+        REQUIRE(detectedPhrase(matches, 5) == 0);
+        
+        // The shortest period wins.
+        matches[0] = 2;
+        matches[2] = 8;
+        REQUIRE(detectedPhrase(matches, 2) == 2);
     }
 }
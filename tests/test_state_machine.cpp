@@ -1,5 +1,6 @@
 #include "catch.hpp"
 #include "../fuel_injector.h"
+#include <cstring>
 
 TEST_CASE("State Machine Integration", "[state][integration]") {
     
@@ -134,3 +135,87 @@ TEST_CASE("State Machine Integration", "[state][integration]") {
         REQUIRE(bar_complete == true);
     }
 }
+
+TEST_CASE("Variation bank selection", "[state_machine]") {
+    SECTION("never repeats the last played variation") {
+        const uint8_t all_ready = (1u << VARIATION_BANK_SIZE) - 1;
+        for (uint32_t r = 0; r < 64; ++r) {
+            int slot = pickVariation(all_ready, 2, r);
+            REQUIRE(slot >= 0);
+            REQUIRE(slot < VARIATION_BANK_SIZE);
+            REQUIRE(slot != 2);
+        }
+    }
+
+    SECTION("only picks ready slots") {
+        for (uint32_t r = 0; r < 16; ++r) {
+            REQUIRE(pickVariation(0x08, -1, r) == 3);
+            REQUIRE(pickVariation(0x09, 0, r) == 3);
+        }
+    }
+
+    SECTION("returns -1 when nothing new is ready") {
+        REQUIRE(pickVariation(0, -1, 7) == -1);
+        REQUIRE(pickVariation(0x02, 1, 7) == -1);
+    }
+
+    SECTION("covers every candidate") {
+        bool seen[VARIATION_BANK_SIZE] = {};
+        for (uint32_t r = 0; r < 16; ++r) {
+            seen[pickVariation(0x0F, 0, r)] = true;
+        }
+        REQUIRE_FALSE(seen[0]);
+        REQUIRE(seen[1]);
+        REQUIRE(seen[2]);
+        REQUIRE(seen[3]);
+    }
+}
+
+TEST_CASE("Per-channel state machines", "[state_machine]") {
+    SECTION("summary reports the most active channel") {
+        uint8_t states[4] = { LEARNING, LEARNING, LEARNING, LEARNING };
+        REQUIRE(summariseChannelStates(states, 4) == LEARNING);
+        states[2] = LOCKED;
+        REQUIRE(summariseChannelStates(states, 4) == LOCKED);
+        states[3] = INJECTING;
+        REQUIRE(summariseChannelStates(states, 4) == INJECTING);
+        REQUIRE(summariseChannelStates(states, 3) == LOCKED);
+    }
+
+    SECTION("ungrouped channels lead themselves") {
+        const uint8_t groups[4] = { 0, 0, 0, 0 };
+        uint8_t leaders[4];
+        resolveGroupLeaders(groups, 4, leaders);
+        for (int c = 0; c < 4; ++c) {
+            REQUIRE(leaders[c] == c);
+        }
+    }
+
+    SECTION("grouped channels follow the first member") {
+        const uint8_t groups[6] = { 0, 1, 2, 1, 0, 2 };
+        uint8_t leaders[6];
+        resolveGroupLeaders(groups, 6, leaders);
+        REQUIRE(leaders[0] == 0);
+        REQUIRE(leaders[1] == 1);
+        REQUIRE(leaders[2] == 2);
+        REQUIRE(leaders[3] == 1);
+        REQUIRE(leaders[4] == 4);
+        REQUIRE(leaders[5] == 2);
+    }
+
+    SECTION("reset returns every channel to learning") {
+        _FuelInjector_DTC dtc;
+        memset(&dtc, 0, sizeof(dtc));
+        PatternLearner learner = {};
+        for (int c = 0; c < MAX_CHANNELS; ++c) {
+            dtc.channel_state[c] = INJECTING;
+            dtc.stable_bars_count[c] = 3;
+        }
+        handleReset(&dtc, &learner);
+        REQUIRE(dtc.state == LEARNING);
+        for (int c = 0; c < MAX_CHANNELS; ++c) {
+            REQUIRE(dtc.channel_state[c] == LEARNING);
+            REQUIRE(dtc.stable_bars_count[c] == 0);
+        }
+    }
+}